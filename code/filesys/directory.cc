@@ -1,19 +1,20 @@
 // directory.cc
 //  Routines to manage a directory of file names.
 //
-//  The directory is a table of fixed length entries; each
-//  entry represents a single file, and contains the file name,
-//  and the location of the file header on disk.  The fixed size
-//  of each directory entry means that we have the restriction
-//  of a fixed maximum size for file names.
+//  The directory is a table of entries; each entry represents a
+//  single file, and contains the file name, and the location of the
+//  file header on disk.  On disk, each entry stores the length of its
+//  name followed by the name itself, so names are not padded to a
+//  fixed size, and slot i of the table is the i'th record of the file.
+//  In memory, names are found through a hash table.
 //
 //  The constructor initializes an empty directory of a certain size;
 //  we use ReadFrom/WriteBack to fetch the contents of the directory
 //  from disk, and to write back any modifications back to disk.
 //
-//  Also, this implementation has the restriction that the size
-//  of the directory cannot expand.  In other words, once all the
-//  entries in the directory are used, no more files can be created.
+//  Neither the in-core table nor the directory file has a fixed
+//  size: the table grows as entries are added, and WriteBack extends
+//  the file when its on-disk form no longer fits.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -21,9 +22,33 @@
 
 #include "copyright.h"
 #include "utility.h"
+#include "debug.h"
 #include "filehdr.h"
 #include "directory.h"
 
+// Marks a directory file written in the current format.
+const int DirMagic = 0x44495232;        // "DIR2"
+
+// Bytes taken on disk by an entry, not counting its name:
+// sector, type, and name length.
+const int DirEntryHeaderSize = 3 * sizeof(int);
+
+//----------------------------------------------------------------------
+// HashName
+//  FNV-1a hash of a file name.
+//----------------------------------------------------------------------
+
+static unsigned int
+HashName(char* name) {
+    unsigned int h = 2166136261u;
+
+    for (; *name != '\0'; name++) {
+        h = (h ^ (unsigned char) *name) * 16777619u;
+    }
+
+    return h;
+}
+
 //----------------------------------------------------------------------
 // Directory::Directory
 //  Initialize a directory; initially, the directory is completely
@@ -31,10 +56,15 @@
 //  is all we need, but otherwise, we need to call FetchFrom in order
 //  to initialize it from disk.
 //
-//  "size" is the number of entries in the directory
+//  "size" is the initial number of entries in the directory; the
+//      table grows if more are added
 //----------------------------------------------------------------------
 
 Directory::Directory(int size) {
+    if (size < 1) {
+        size = 1;
+    }
+
     table = new DirectoryEntry[size];
 
     // MP4 mod tag
@@ -44,7 +74,23 @@ Directory::Directory(int size) {
 
     for (int i = 0; i < tableSize; i++) {
         table[i].inUse = FALSE;
+        table[i].name = NULL;
+        table[i].diskLen = 0;
+        table[i].nextFree = -1;
+    }
+
+    hashSize = 1;
+    while (hashSize < 2 * tableSize) {
+        hashSize *= 2;
     }
+    hashIndex = new int[hashSize];
+    for (int i = 0; i < hashSize; i++) {
+        hashIndex[i] = -1;
+    }
+
+    image = NULL;
+    imageSize = 0;
+    Clear();
 }
 
 //----------------------------------------------------------------------
@@ -53,31 +99,314 @@ Directory::Directory(int size) {
 //----------------------------------------------------------------------
 
 Directory::~Directory() {
+    Clear();
     delete [] table;
+    delete [] hashIndex;
+    delete [] image;
+}
+
+//----------------------------------------------------------------------
+// Directory::Clear
+//  Remove every entry from the in-core directory.
+//----------------------------------------------------------------------
+
+void
+Directory::Clear() {
+    for (int i = 0; i < tableSize; i++) {
+        if (table[i].inUse) {
+            delete [] table[i].name;
+            table[i].name = NULL;
+            table[i].inUse = FALSE;
+        }
+        table[i].diskLen = 0;
+        table[i].nextFree = -1;
+    }
+
+    for (int i = 0; i < hashSize; i++) {
+        hashIndex[i] = -1;
+    }
+
+    for (int i = 0; i <= FileNameMaxLen; i++) {
+        freeRecord[i] = -1;
+    }
+
+    numEntries = 0;
+    numRecords = 0;
+    diskSize = 2 * sizeof(int);
 }
 
 //----------------------------------------------------------------------
 // Directory::FetchFrom
-//  Read the contents of the directory from disk.
+//  Read the contents of the directory from disk, and keep what was
+//  read, so WriteBack can tell what changed.
 //
 //  "file" -- file containing the directory contents
 //----------------------------------------------------------------------
 
 void
 Directory::FetchFrom(OpenFile* file) {
-    (void) file->ReadAt((char*)table, tableSize * sizeof(DirectoryEntry), 0);
+    int length = file->Length();
+    char* buf = new char[length];
+    int magic, count, offset = 0;
+
+    ASSERT(length >= 2 * (int) sizeof(int));
+    (void) file->ReadAt(buf, length, 0);
+    Clear();
+
+    memcpy(&magic, buf + offset, sizeof(int));
+    offset += sizeof(int);
+    ASSERT(magic == DirMagic);
+    memcpy(&count, buf + offset, sizeof(int));
+    offset += sizeof(int);
+
+    for (int i = 0; i < count; i++) {
+        int sector, type, nameLen;
+        char name[FileNameMaxLen + 1];
+
+        memcpy(&sector, buf + offset, sizeof(int));
+        memcpy(&type, buf + offset + sizeof(int), sizeof(int));
+        memcpy(&nameLen, buf + offset + 2 * sizeof(int), sizeof(int));
+        offset += DirEntryHeaderSize;
+
+        ASSERT(nameLen > 0 && nameLen <= FileNameMaxLen);
+        memcpy(name, buf + offset, nameLen);
+        name[nameLen] = '\0';
+        offset += nameLen;
+
+        int slot = AppendRecord(nameLen);
+
+        if (sector == -1) {     // a free record
+            table[slot].nextFree = freeRecord[nameLen];
+            freeRecord[nameLen] = slot;
+        } else {
+            ASSERT(FindIndex(name) == -1);
+            table[slot].inUse = TRUE;
+            table[slot].sector = sector;
+            table[slot].type = type;
+            table[slot].name = new char[nameLen + 1];
+            strcpy(table[slot].name, name);
+            InsertHash(slot);
+            numEntries++;
+        }
+    }
+
+    delete [] image;
+    image = buf;
+    imageSize = length;
 }
 
 //----------------------------------------------------------------------
 // Directory::WriteBack
-//  Write any modifications to the directory back to disk
+//  Write any modifications to the directory back to disk.  Return FALSE if the directory has outgrown
+//  its file and the disk has no room to extend it.
+//
+//  The part past the old end of the file is written first; if that
+//  fails, the old contents, and the record count at their front, are
+//  left as they were.  Of the old contents, only the sectors that
+//  differ from what the file holds are written.
 //
 //  "file" -- file to contain the new directory contents
 //----------------------------------------------------------------------
 
-void
+bool
 Directory::WriteBack(OpenFile* file) {
-    (void) file->WriteAt((char*)table, tableSize * sizeof(DirectoryEntry), 0);
+    char* buf = new char[diskSize];
+    int offset = 0;
+
+    memcpy(buf + offset, &DirMagic, sizeof(int));
+    offset += sizeof(int);
+    memcpy(buf + offset, &numRecords, sizeof(int));
+    offset += sizeof(int);
+
+    for (int i = 0; i < numRecords; i++) {
+        int nameLen = table[i].diskLen;
+        int sector = table[i].inUse ? table[i].sector : -1;
+        int type = table[i].inUse ? table[i].type : 0;
+
+        memcpy(buf + offset, &sector, sizeof(int));
+        memcpy(buf + offset + sizeof(int), &type, sizeof(int));
+        memcpy(buf + offset + 2 * sizeof(int), &nameLen, sizeof(int));
+        offset += DirEntryHeaderSize;
+        if (table[i].inUse) {
+            memcpy(buf + offset, table[i].name, nameLen);
+        } else {
+            memset(buf + offset, 0, nameLen);
+        }
+        offset += nameLen;
+    }
+
+    ASSERT(offset == diskSize);
+
+    int length = min(file->Length(), diskSize);
+
+    if (diskSize > length
+            && file->WriteAt(buf + length, diskSize - length, length) != diskSize - length) {
+        delete [] buf;
+        return FALSE;       // disk is full
+    }
+
+    // write each run of adjacent sectors that changed in one go
+    int numSectors = divRoundUp(length, SectorSize);
+
+    for (int first = 0; first < numSectors; first++) {
+        if (SameOnDisk(buf, first * SectorSize, length)) {
+            continue;
+        }
+
+        int last = first;
+        while (last + 1 < numSectors && !SameOnDisk(buf, (last + 1) * SectorSize, length)) {
+            last++;
+        }
+
+        int start = first * SectorSize;
+        int count = min((last + 1) * SectorSize, length) - start;
+
+        ASSERT(file->WriteAt(buf + start, count, start) == count);
+        first = last;
+    }
+
+    if (image != NULL && imageSize > diskSize) {
+        memcpy(image, buf, diskSize);   // the file goes on past it
+        delete [] buf;
+    } else {
+        delete [] image;
+        image = buf;
+        imageSize = diskSize;
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Directory::SameOnDisk
+//  Return TRUE if the file sector starting at byte "offset" already
+//  holds what "buf" has there, as far as the first "length" bytes of
+//  the file go.
+//----------------------------------------------------------------------
+
+bool
+Directory::SameOnDisk(char* buf, int offset, int length) {
+    int count = min(SectorSize, length - offset);
+
+    return image != NULL && offset + count <= imageSize
+           && memcmp(buf + offset, image + offset, count) == 0;
+}
+
+//----------------------------------------------------------------------
+// Directory::FindBucket
+//  Return the hash bucket that refers to the entry called "name",
+//  or -1 if there is none.  Buckets are probed linearly from the
+//  one the name hashes to, up to the first empty bucket.
+//
+//  "name" -- the file name to look up
+//----------------------------------------------------------------------
+
+int
+Directory::FindBucket(char* name) {
+    int mask = hashSize - 1;
+
+    for (int b = HashName(name) & mask; hashIndex[b] != -1; b = (b + 1) & mask) {
+        if (!strcmp(table[hashIndex[b]].name, name)) {
+            return b;
+        }
+    }
+
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// Directory::InsertHash
+//  Enter table entry "index" into the hash index, under its name.
+//----------------------------------------------------------------------
+
+void
+Directory::InsertHash(int index) {
+    int mask = hashSize - 1;
+    int b = HashName(table[index].name) & mask;
+
+    while (hashIndex[b] != -1) {
+        b = (b + 1) & mask;
+    }
+
+    hashIndex[b] = index;
+}
+
+//----------------------------------------------------------------------
+// Directory::RemoveHash
+//  Empty hash bucket "bucket".  Later buckets of the same probe run
+//  are shifted back into the hole when their home bucket allows it,
+//  so that lookups never need to skip over deleted buckets.
+//----------------------------------------------------------------------
+
+void
+Directory::RemoveHash(int bucket) {
+    int mask = hashSize - 1;
+    int hole = bucket;
+
+    hashIndex[hole] = -1;
+
+    for (int b = (hole + 1) & mask; hashIndex[b] != -1; b = (b + 1) & mask) {
+        int home = HashName(table[hashIndex[b]].name) & mask;
+
+        // can the entry in "b" move back to "hole"?  only if its home
+        // bucket is not cyclically between the hole and "b"
+        if (((b - home) & mask) >= ((b - hole) & mask)) {
+            hashIndex[hole] = hashIndex[b];
+            hashIndex[b] = -1;
+            hole = b;
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// Directory::Rehash
+//  Rebuild the hash index with "newSize" buckets.
+//----------------------------------------------------------------------
+
+void
+Directory::Rehash(int newSize) {
+    delete [] hashIndex;
+    hashSize = newSize;
+    hashIndex = new int[hashSize];
+
+    for (int i = 0; i < hashSize; i++) {
+        hashIndex[i] = -1;
+    }
+
+    for (int i = 0; i < tableSize; i++) {
+        if (table[i].inUse) {
+            InsertHash(i);
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// Directory::Grow
+//  Double the number of entries in the in-core table, keeping the
+//  hash index at most half full.
+//----------------------------------------------------------------------
+
+void
+Directory::Grow() {
+    DirectoryEntry* newTable = new DirectoryEntry[tableSize * 2];
+
+    memcpy(newTable, table, sizeof(DirectoryEntry) * tableSize);
+
+    for (int i = tableSize; i < tableSize * 2; i++) {
+        newTable[i].inUse = FALSE;
+        newTable[i].sector = -1;
+        newTable[i].type = 0;
+        newTable[i].name = NULL;
+        newTable[i].diskLen = 0;
+        newTable[i].nextFree = -1;
+    }
+
+    delete [] table;
+    table = newTable;
+    tableSize *= 2;
+
+    if (hashSize < 2 * tableSize) {
+        Rehash(2 * tableSize);
+    }
 }
 
 //----------------------------------------------------------------------
@@ -90,10 +419,10 @@ Directory::WriteBack(OpenFile* file) {
 
 int
 Directory::FindIndex(char* name) {
-    for (int i = 0; i < tableSize; i++) {
-        if (table[i].inUse && !strncmp(table[i].name, name, FileNameMaxLen)) {
-            return i;
-        }
+    int b = FindBucket(name);
+
+    if (b != -1) {
+        return hashIndex[b];
     }
 
     return -1;      // name not in directory
@@ -120,69 +449,113 @@ Directory::Find(char* name) {
 }
 
 //----------------------------------------------------------------------
-// Directory::Add
-//  Add a file into the directory.  Return TRUE if successful;
-//  return FALSE if the file name is already in the directory, or if
-//  the directory is completely full, and has no more space for
-//  additional file names.
+// Directory::AddEntry
+//  Add an entry of the given type.  Return FALSE if the name is
+//  already in the directory or is not a legal name.
 //
-//  "name" -- the name of the file being added
-//  "newSector" -- the disk sector containing the added file's header
+//  The new entry takes over a free record with a name of the same
+//  length if there is one, and a new record at the end otherwise.
 //----------------------------------------------------------------------
 
 bool
-Directory::Add(char* name, int newSector) {
+Directory::AddEntry(char* name, int newSector, int type) {
+    int nameLen = strlen(name);
+
+    if (nameLen == 0 || nameLen > FileNameMaxLen) {
+        return FALSE;
+    }
+
     if (FindIndex(name) != -1) {
         return FALSE;
     }
 
-    for (int i = 0; i < tableSize; i++)
-        if (!table[i].inUse) {
-            table[i].type = 0;
-            table[i].inUse = TRUE;
-            strncpy(table[i].name, name, FileNameMaxLen);
-            table[i].sector = newSector;
-            return TRUE;
-        }
+    int slot = freeRecord[nameLen];
+
+    if (slot != -1) {
+        freeRecord[nameLen] = table[slot].nextFree;
+    } else {
+        slot = AppendRecord(nameLen);
+    }
 
-    return FALSE;   // no space.  Fix when we have extensible files.
+    DirectoryEntry* entry = &table[slot];
+    entry->type = type;
+    entry->inUse = TRUE;
+    entry->name = new char[nameLen + 1];
+    strcpy(entry->name, name);
+    entry->sector = newSector;
+
+    InsertHash(slot);
+    numEntries++;
+    return TRUE;
 }
 
-bool
-Directory::AddDir(char* name, int newSector) {
-    if (FindIndex(name) != -1) {
-        return FALSE;
+//----------------------------------------------------------------------
+// Directory::AppendRecord
+//  Add a record for a name of "nameLen" bytes at the end of the
+//  on-disk form, in the next table slot, growing the table if every
+//  slot is taken.  Return the slot.
+//----------------------------------------------------------------------
+
+int
+Directory::AppendRecord(int nameLen) {
+    if (numRecords == tableSize) {
+        Grow();
     }
 
-    for (int i = 0; i < tableSize; i++)
-        if (!table[i].inUse) {
-            table[i].type = 1;
-            table[i].inUse = TRUE;
-            strncpy(table[i].name, name, FileNameMaxLen);
-            table[i].sector = newSector;
-            return TRUE;
-        }
+    table[numRecords].diskLen = nameLen;
+    table[numRecords].nextFree = -1;
+    diskSize += DirEntryHeaderSize + nameLen;
+    return numRecords++;
+}
+
+//----------------------------------------------------------------------
+// Directory::Add
+//  Add a file into the directory.  Return TRUE if successful;
+//  return FALSE if the file name is already in the directory, or is
+//  not a legal name.  The directory never fills up; WriteBack extends
+//  its file as needed.
+//
+//  "name" -- the name of the file being added
+//  "newSector" -- the disk sector containing the added file's header
+//----------------------------------------------------------------------
+
+bool
+Directory::Add(char* name, int newSector) {
+    return AddEntry(name, newSector, 0);
+}
 
-    return FALSE;   // no space.  Fix when we have extensible files.
+bool
+Directory::AddDir(char* name, int newSector) {
+    return AddEntry(name, newSector, 1);
 }
 
 //----------------------------------------------------------------------
 // Directory::Remove
 //  Remove a file name from the directory.  Return TRUE if successful;
-//  return FALSE if the file isn't in the directory.
+//  return FALSE if the file isn't in the directory.  Its record stays,
+//  free, for the next name of the same length.
 //
 //  "name" -- the file name to be removed
 //----------------------------------------------------------------------
 
 bool
 Directory::Remove(char* name) {
-    int i = FindIndex(name);
+    int b = FindBucket(name);
 
-    if (i == -1) {
+    if (b == -1) {
         return FALSE;    // name not in directory
     }
 
+    int i = hashIndex[b];
+    RemoveHash(b);
+
+    delete [] table[i].name;
+    table[i].name = NULL;
     table[i].inUse = FALSE;
+    numEntries--;
+
+    table[i].nextFree = freeRecord[table[i].diskLen];
+    freeRecord[table[i].diskLen] = i;
     return TRUE;
 }
 
@@ -193,15 +566,13 @@ Directory::Remove(char* name) {
 
 void
 Directory::List() {
-    int totalCount = 0;
     for (int i = 0; i < tableSize; i++)
         if (table[i].inUse) {
-            totalCount++;
             cout << (table[i].type ? "\x1B[1;34m" : "");
             cout << table[i].name << (table[i].type ? "/" : "");
             cout << "\x1B[0m" << endl;
         }
-    cout << "Total: " << totalCount << endl;
+    cout << "Total: " << numEntries << endl;
 }
 
 //----------------------------------------------------------------------
@@ -19,8 +19,8 @@
 
 #include "openfile.h"
 
-#define FileNameMaxLen      9   // for simplicity, we assume
-// file names are <= 9 characters long
+#define FileNameMaxLen      255 // names are stored with their length,
+// so only this bound is fixed
 
 // The following class defines a "directory entry", representing a file
 // in the directory.  Each entry gives the name of the file, and where
@@ -35,15 +35,33 @@ public:
     int sector;             // Location on disk to find the
     int type;               // 0 for normal file, 1 for directory
     //   FileHeader for this file
-    char name[FileNameMaxLen + 1];  // Text name for file, with +1 for
-    // the trailing '\0'
+    char* name;             // Text name for file, '\0' terminated
+    int diskLen;            // Name length of its record on disk,
+    // 0 if it has none yet
+    int nextFree;           // For a free record, the next free
+    // one with the same name length
 };
 
 // The following class defines a UNIX-like "directory".  Each entry in
 // the directory describes a file, and where to find it on disk.
 //
 // The directory data structure can be stored in memory, or on disk.
-// When it is on disk, it is stored as a regular Nachos file.
+// When it is on disk, it is stored as a regular Nachos file, in this
+// format:
+//
+//      DirMagic, number of records,
+//      then for each record: sector, type, name length, name bytes
+//
+// Each entry keeps its record, at the same place in the file, for as
+// long as it is in the directory.  Removing it leaves a free record
+// (sector -1), which the next name of the same length reuses.  So
+// adding or removing an entry only changes the sectors holding its
+// record, and those holding the record count when one is added at
+// the end; WriteBack writes just the sectors that changed.
+//
+// In core, the entries live in a table that doubles when it fills up,
+// and an open-addressing hash table maps each name to its entry, so
+// Find, Add and Remove take constant time on average.
 //
 // The constructor initializes a directory structure in memory; the
 // FetchFrom/WriteBack operations shuffle the directory information
@@ -56,8 +74,9 @@ public:
     ~Directory();           // De-allocate the directory
 
     void FetchFrom(OpenFile* file);     // Init directory contents from disk
-    void WriteBack(OpenFile* file); // Write modifications to
-    // directory contents back to disk
+    bool WriteBack(OpenFile* file); // Write modifications to
+    // directory contents back to disk;
+    // FALSE if the disk is full
 
     int Find(char* name);       // Find the sector number of the
     // FileHeader for file: "name"
@@ -68,6 +87,10 @@ public:
 
     bool Remove(char* name);        // Remove a file from the directory
 
+    int NumEntries() {
+        return numEntries;    // Number of names in the directory
+    }
+
     void List();            // Print the names of all the files
     //  in the directory
     void Print();           // Verbose print of the contents
@@ -75,20 +98,46 @@ public:
     //  names and their contents.
 
     /*
-     * TODO
         MP4 Hint:
         Directory is actually a "file", be careful of how it works with OpenFile and FileHdr.
-        Disk part: table
-        In-core part: tableSize
+        Disk part: the records, serialized by WriteBack
+        In-core part: tableSize, hash index, free records
     */
 
-    int entryIdx;
     int tableSize;          // Number of directory entries
     DirectoryEntry* table;      // Table of pairs:
     // <file name, file header location>
 
     int FindIndex(char* name);      // Find the index into the directory
     //  table corresponding to "name"
+
+private:
+    int numEntries;         // Number of entries in use
+    int numRecords;         // Records on disk, free ones too: the
+    // first numRecords slots of the table
+    int freeRecord[FileNameMaxLen + 1]; // For each name length, a
+    // free record of that length, or -1
+    int hashSize;           // Number of hash buckets (a power of 2)
+    int* hashIndex;         // Entry index for each bucket, or
+    // -1 if the bucket is empty
+    int diskSize;           // Bytes taken by the on-disk form
+    char* image;            // The directory file as last read or
+    // written, NULL if not known
+    int imageSize;          // Its length
+
+    bool AddEntry(char* name, int newSector, int type);
+    int AppendRecord(int nameLen);  // Give a new record at the end
+    // to the next table slot
+    bool SameOnDisk(char* buf, int offset, int length);
+    // Does the file already hold the
+    // sector of "buf" at "offset"?
+    void Grow();            // Double the size of the entry table
+    void Rehash(int newSize);       // Rebuild the hash index
+    int FindBucket(char* name);     // Bucket holding "name", or -1
+    void InsertHash(int index);     // Index entry "index" by its name
+    void RemoveHash(int bucket);    // Empty a bucket, keeping the
+    // probe sequences of the others intact
+    void Clear();           // Drop all entries
 };
 
 #endif // DIRECTORY_H
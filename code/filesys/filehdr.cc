@@ -3,12 +3,15 @@
 //  would be called the i-node).
 //
 //  The file header is used to locate where on disk the
-//  file's data is stored.  We implement this as a fixed size
-//  table of pointers -- each entry in the table points to the
-//  disk sector containing that portion of the file data
-//  (in other words, there are no indirect or doubly indirect
-//  blocks). The table size is chosen so that the file header
-//  will be just big enough to fit in one disk sector,
+//  file's data is stored.  We implement this as a UNIX-style i-node:
+//  a fixed size table of pointers to the first data blocks, and
+//  pointers to a single, double and triple indirect block for the
+//  rest of the file.  The table size is chosen so that the file
+//  header will be just big enough to fit in one disk sector.
+//
+//  Finding the sector of a byte costs one pointer lookup per level
+//  of indirection; indirect blocks are read and written a pointer
+//  at a time through the disk cache.
 //
 //      Unlike in a real system, we do not keep track of file permissions,
 //  ownership, last modification date, etc., in the file header.
@@ -18,6 +21,9 @@
 //       to point to the newly allocated data blocks
 //     for a file already on disk, by reading the file header from disk
 //
+//  Data blocks need not be allocated when the file is created:
+//  AllocateRange fills in the holes of a file as it is written.
+//
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
 // of liability and disclaimer of warranty provisions.
@@ -29,6 +35,10 @@
 #include "synchdisk.h"
 #include "main.h"
 
+// A fresh run of blocks is sized for at most this many sectors of the
+// hole it goes into, so finding out how long the hole is stays cheap.
+const int MaxRunSectors = 1024;
+
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileHeader::FileHeader
@@ -39,25 +49,17 @@
 FileHeader::FileHeader() {
     numBytes = -1;
     numSectors = -1;
-    level = -1;
     memset(dataSectors, -1, sizeof(dataSectors));
-}
-
-//----------------------------------------------------------------------
-// MP4 mod tag
-// FileHeader::~FileHeader
-//  Currently, there is not need to do anything in destructor function.
-//  However, if you decide to add some "in-core" data in header
-//  Always remember to deallocate their space or you will leak memory
-//----------------------------------------------------------------------
-FileHeader::~FileHeader() {
-    // nothing to do now
+    memset(indirectSectors, -1, sizeof(indirectSectors));
+    sector = -1;
+    refCount = 0;
 }
 
 //----------------------------------------------------------------------
 // FileHeader::Allocate
 //  Initialize a fresh file header for a newly created file.
-//  Allocate data blocks for the file out of the map of free disk blocks.
+//  Allocate data blocks for the whole file out of the map of free
+//  disk blocks.
 //  Return FALSE if there are not enough free blocks to accomodate
 //  the new file.
 //
@@ -67,76 +69,373 @@ FileHeader::~FileHeader() {
 
 bool
 FileHeader::Allocate(PersistentBitmap* freeMap, int fileSize) {
+    int sectors = divRoundUp(fileSize, SectorSize);
+    int needed = sectors;
+
+    // count the indirect blocks too: every level of each tree, down
+    // to the blocks pointing at data
+    int rest = sectors - NumDirect;
+
+    for (int d = 1; d <= NumIndirectLevels && rest > 0; d++) {
+        int covered = min(rest, Span(d));
+
+        for (int level = 1; level <= d; level++) {
+            needed += divRoundUp(covered, Span(level));
+        }
+        rest -= Span(d);
+    }
+
     numBytes = fileSize;
-    numSectors = divRoundUp(fileSize, SectorSize);
+    numSectors = 0;
+    memset(dataSectors, -1, sizeof(dataSectors));
+    memset(indirectSectors, -1, sizeof(indirectSectors));
 
-    if (freeMap->NumClear() < numSectors) {
+    if (fileSize > MaxLength() || freeMap->NumClear() < needed) {
         return FALSE;    // not enough space
     }
 
-    for (int i = 0; i < numSectors; i++) {
-        dataSectors[i] = freeMap->FindAndSet();
-        // since we checked that there was enough free space,
-        // we expect this to succeed
-        ASSERT(dataSectors[i] >= 0);
+    if (sectors == 0) {
+        return TRUE;
+    }
+
+    return AllocateRange(freeMap, 0, sectors - 1, sectors - 1);
+}
+
+//----------------------------------------------------------------------
+// FileHeader::AllocateRange
+//  Allocate disk blocks for every hole among file sectors "fromSector"
+//  through "toSector", which may lie past the current end of the file.
+//  Return FALSE if the disk fills up first; the blocks allocated until
+//  then stay part of the file.
+//
+//  The blocks are handed out in contiguous runs (extents), so that
+//  a sequential scan of the file moves the disk head as little as
+//  possible and can be served from the track buffer.  A hole that
+//  follows an allocated block is first filled from the blocks right
+//  after that one, so a file written a little at a time still ends
+//  up contiguous.  Otherwise we look for a run as long as the whole
+//  hole, even where it goes on past "toSector" (a large write gives
+//  blocks to a few sectors at a time), and whenever no run that long
+//  is free, we halve the run length and try again.
+//
+//  "freeMap" is the bit map of free disk sectors
+//  "fromSector", "toSector" -- the range of file sectors, inclusive
+//  "extent" -- the last file sector that is about to get blocks
+//----------------------------------------------------------------------
+
+bool
+FileHeader::AllocateRange(PersistentBitmap* freeMap, int fromSector,
+                          int toSector, int extent) {
+    int maxSectors = divRoundUp(MaxLength(), SectorSize);
+
+    if (toSector >= maxSectors) {
+        return FALSE;    // file would be too big
+    }
+
+    // each file sector is looked up once: "prev" is where the sector
+    // before "s" is, and "cur" where "s" is, if already known
+    int prev = (fromSector > 0) ? ByteToSector((fromSector - 1) * SectorSize) : -1;
+    int cur = ByteToSector(fromSector * SectorSize);
+
+    for (int s = fromSector; s <= toSector;) {
+        if (cur != -1) {
+            prev = cur;
+            s++;
+            cur = (s <= toSector) ? ByteToSector(s * SectorSize) : -1;
+            continue;
+        }
+
+        int want = 1;           // length of the hole
+        int after = -1;         // where the sector after the hole is
+
+        while (s + want <= toSector
+               && (after = ByteToSector((s + want) * SectorSize)) == -1) {
+            want++;
+        }
+
+        int first, got;
+
+        if (prev != -1 && prev + 1 < NumSectors && !freeMap->Test(prev + 1)) {
+            first = prev + 1;
+
+            for (got = 0; got < want && first + got < NumSectors
+                 && !freeMap->Test(first + got); got++) {
+                freeMap->Mark(first + got);
+            }
+        } else {
+            int run = want;
+
+            if (s + want > toSector) {      // the hole may go on
+                int last = min(min(extent, maxSectors - 1), s + MaxRunSectors - 1);
+
+                while (s + run <= last && ByteToSector((s + run) * SectorSize) == -1) {
+                    run++;
+                }
+            }
+
+            while ((first = freeMap->FindRun(run)) == -1) {
+                if (run == 1) {
+                    return FALSE;    // disk is full
+                }
+
+                run /= 2;
+            }
+
+            got = min(run, want);
+            for (int i = 0; i < got; i++) {
+                freeMap->Mark(first + i);
+            }
+        }
+
+        for (int i = 0; i < got; i++) {
+            if (!SetSector(freeMap, s + i, first + i)) {
+                // no room for an indirect block: give back the
+                // data blocks that could not be recorded
+                for (; i < got; i++) {
+                    freeMap->Clear(first + i);
+                }
+
+                return FALSE;
+            }
+        }
+
+        prev = first + got - 1;
+        s += got;
+        cur = (got == want) ? after : -1;   // else still in the hole
     }
 
     return TRUE;
 }
 
+//----------------------------------------------------------------------
+// FileHeader::Locate
+//  Return which pointer tree holds file sector "fileSector", and the
+//  index of the sector within that tree.  "depth" is set to 0 for the
+//  direct pointers, and to 1, 2 or 3 for the single, double or triple
+//  indirect block.  Return -1 if the sector is beyond the largest
+//  possible file.
+//----------------------------------------------------------------------
+
+int
+FileHeader::Locate(int fileSector, int* depth) {
+    if (fileSector < NumDirect) {
+        *depth = 0;
+        return fileSector;
+    }
+
+    fileSector -= NumDirect;
+
+    for (int d = 1; d <= NumIndirectLevels; d++) {
+        if (fileSector < Span(d)) {
+            *depth = d;
+            return fileSector;
+        }
+
+        fileSector -= Span(d);
+    }
+
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::Span
+//  Return the number of data blocks reachable from an indirect block
+//  "depth" levels above them; Span(0) is a data block itself.
+//----------------------------------------------------------------------
+
+int
+FileHeader::Span(int depth) {
+    int span = 1;
+
+    for (int d = 0; d < depth; d++) {
+        span *= PointersPerSector;
+    }
+
+    return span;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::ReadPointer/WritePointer
+//  Read or write pointer "index" of indirect block "block".
+//----------------------------------------------------------------------
+
+int
+FileHeader::ReadPointer(int block, int index) {
+    int sector;
+
+    kernel->synchDisk->ReadPartial(block, (char*) &sector,
+                                   index * sizeof(int), sizeof(int));
+    return sector;
+}
+
+void
+FileHeader::WritePointer(int block, int index, int sector) {
+    kernel->synchDisk->WritePartial(block, (char*) &sector,
+                                    index * sizeof(int), sizeof(int));
+}
+
+//----------------------------------------------------------------------
+// FileHeader::NewIndirectBlock
+//  Allocate an indirect block with every pointer set to -1.  Return
+//  its sector, or -1 if the disk is full.
+//
+//  The block is written as a whole sector, so the cache does not read
+//  in its old contents first.
+//----------------------------------------------------------------------
+
+int
+FileHeader::NewIndirectBlock(PersistentBitmap* freeMap) {
+    int block = freeMap->FindAndSet();
+
+    if (block != -1) {
+        int* pointers = new int[PointersPerSector];
+
+        for (int i = 0; i < PointersPerSector; i++) {
+            pointers[i] = -1;
+        }
+
+        kernel->synchDisk->WriteSector(block, (char*) pointers);
+        delete [] pointers;
+    }
+
+    return block;
+}
+
+//----------------------------------------------------------------------
+// FileHeader::SetSector
+//  Record that file sector "fileSector" is stored in "diskSector",
+//  allocating the indirect blocks on the way to it if they do not
+//  exist yet.  Return FALSE if there is no room for those.
+//----------------------------------------------------------------------
+
+bool
+FileHeader::SetSector(PersistentBitmap* freeMap, int fileSector, int diskSector) {
+    int depth;
+    int index = Locate(fileSector, &depth);
+
+    ASSERT(index != -1);
+
+    if (depth == 0) {
+        dataSectors[index] = diskSector;
+        numSectors++;
+        return TRUE;
+    }
+
+    if (indirectSectors[depth - 1] == -1) {
+        indirectSectors[depth - 1] = NewIndirectBlock(freeMap);
+
+        if (indirectSectors[depth - 1] == -1) {
+            return FALSE;
+        }
+    }
+
+    int block = indirectSectors[depth - 1];
+    int span = Span(depth - 1);
+
+    // walk down to the single indirect block holding the pointer
+    for (; span > 1; span /= PointersPerSector) {
+        int slot = (index / span) % PointersPerSector;
+        int next = ReadPointer(block, slot);
+
+        if (next == -1) {
+            next = NewIndirectBlock(freeMap);
+
+            if (next == -1) {
+                return FALSE;
+            }
+
+            WritePointer(block, slot, next);
+        }
+
+        block = next;
+    }
+
+    WritePointer(block, index % PointersPerSector, diskSector);
+    numSectors++;
+    return TRUE;
+}
+
 //----------------------------------------------------------------------
 // FileHeader::Deallocate
-//  De-allocate all the space allocated for data blocks for this file.
+//  De-allocate all the space allocated for data blocks for this file,
+//  including its indirect blocks.
 //
 //  "freeMap" is the bit map of free disk sectors
 //----------------------------------------------------------------------
 
 void
 FileHeader::Deallocate(PersistentBitmap* freeMap) {
-    for (int i = 0; i < numSectors; i++) {
-        ASSERT(freeMap->Test((int) dataSectors[i]));  // ought to be marked!
-        freeMap->Clear((int) dataSectors[i]);
+    for (int i = 0; i < NumDirect; i++) {
+        FreeTree(freeMap, dataSectors[i], 0);
+    }
+
+    for (int d = 0; d < NumIndirectLevels; d++) {
+        FreeTree(freeMap, indirectSectors[d], d + 1);
     }
 }
 
+//----------------------------------------------------------------------
+// FileHeader::FreeTree
+//  Free "block", and if it is an indirect block ("depth" > 0), every
+//  block it points to.  A block of -1 is a hole, and is skipped.
+//----------------------------------------------------------------------
+
+void
+FileHeader::FreeTree(PersistentBitmap* freeMap, int block, int depth) {
+    if (block == -1) {
+        return;
+    }
+
+    if (depth > 0) {
+        for (int i = 0; i < PointersPerSector; i++) {
+            FreeTree(freeMap, ReadPointer(block, i), depth - 1);
+        }
+    }
+
+    ASSERT(freeMap->Test(block));  // ought to be marked!
+    freeMap->Clear(block);
+}
+
 //----------------------------------------------------------------------
 // FileHeader::FetchFrom
-//  Fetch contents of file header from disk.
+//  Fetch contents of file header from disk, in a single access to
+//  the disk cache.
 //
 //  "sector" is the disk sector containing the file header
 //----------------------------------------------------------------------
 
 void
 FileHeader::FetchFrom(int sector) {
-    kernel->synchDisk->ReadSector(sector, (char*)this);
-
-    /*
-        MP4 Hint:
-        After you add some in-core informations, you will need to rebuild the header's structure
-    */
-
+    int buf[HeaderSize / sizeof(int)];
+    int* p = buf;
+
+    kernel->synchDisk->ReadPartial(sector, (char*) buf, 0, HeaderSize);
+    numBytes = *p++;
+    numSectors = *p++;
+    bcopy(p, dataSectors, sizeof(dataSectors));
+    p += NumDirect;
+    bcopy(p, indirectSectors, sizeof(indirectSectors));
 }
 
 //----------------------------------------------------------------------
 // FileHeader::WriteBack
-//  Write the modified contents of the file header back to disk.
+//  Write the modified contents of the file header back to disk, in a
+//  single access to the disk cache.
 //
 //  "sector" is the disk sector to contain the file header
 //----------------------------------------------------------------------
 
 void
 FileHeader::WriteBack(int sector) {
-    kernel->synchDisk->WriteSector(sector, (char*)this);
-
-    /*
-        MP4 Hint:
-        After you add some in-core informations, you may not want to write all fields into disk.
-        Use this instead:
-        char buf[SectorSize];
-        memcpy(buf + offset, &dataToBeWritten, sizeof(dataToBeWritten));
-        ...
-    */
-
+    int buf[HeaderSize / sizeof(int)];
+    int* p = buf;
+
+    *p++ = numBytes;
+    *p++ = numSectors;
+    bcopy(dataSectors, p, sizeof(dataSectors));
+    p += NumDirect;
+    bcopy(indirectSectors, p, sizeof(indirectSectors));
+    kernel->synchDisk->WritePartial(sector, (char*) buf, 0, HeaderSize);
 }
 
 //----------------------------------------------------------------------
@@ -146,30 +445,34 @@ FileHeader::WriteBack(int sector) {
 //  offset in the file) to a physical address (the sector where the
 //  data at the offset is stored).
 //
+//  This takes one pointer lookup per level of indirection between
+//  the header and the data block.  Return -1 if no block has been
+//  allocated for the byte yet.
+//
 //  "offset" is the location within the file of the byte in question
 //----------------------------------------------------------------------
 
 int
 FileHeader::ByteToSector(int offset) {
-    offset = offset / SectorSize;
-    FileHeader* level1Hdr = new FileHeader[numSectors];
+    int depth;
+    int index = Locate(offset / SectorSize, &depth);
+
+    if (index == -1) {
+        return -1;
+    }
 
-    int request;
+    if (depth == 0) {
+        return dataSectors[index];
+    }
 
-    if (level == 0) {
-        for (int i = 0; i < numSectors; ++i) {
-            level1Hdr[i].FetchFrom(dataSectors[i]);
-        }
+    int sector = indirectSectors[depth - 1];
 
-        int level1HdrIdx = offset / NumDirect;
-        int level1Offset = offset % NumDirect;
-        request = level1Hdr[level1HdrIdx].dataSectors[level1Offset];
-    } else {
-        request = dataSectors[offset];
+    for (int span = Span(depth - 1); sector != -1 && span > 0;
+         span /= PointersPerSector) {
+        sector = ReadPointer(sector, (index / span) % PointersPerSector);
     }
 
-    delete[] level1Hdr;
-    return request;
+    return sector;
 }
 
 //----------------------------------------------------------------------
@@ -182,6 +485,24 @@ FileHeader::FileLength() {
     return numBytes;
 }
 
+//----------------------------------------------------------------------
+// FileHeader::MaxLength
+//  Return the largest number of bytes a file can hold: what the
+//  direct and indirect pointers can reach, but no more than the
+//  whole disk.
+//----------------------------------------------------------------------
+
+int
+FileHeader::MaxLength() {
+    int sectors = NumDirect;
+
+    for (int d = 1; d <= NumIndirectLevels && sectors < NumSectors; d++) {
+        sectors += Span(d);
+    }
+
+    return min(sectors, NumSectors) * SectorSize;
+}
+
 //----------------------------------------------------------------------
 // FileHeader::Print
 //  Print the contents of the file header, and the contents of all
@@ -191,18 +512,27 @@ FileHeader::FileLength() {
 void
 FileHeader::Print() {
     int i, j, k;
+    int fileSectors = divRoundUp(numBytes, SectorSize);
     char* data = new char[SectorSize];
 
     printf("FileHeader contents.  File size: %d.  File blocks:\n", numBytes);
 
-    for (i = 0; i < numSectors; i++) {
-        printf("%d ", dataSectors[i]);
+    for (i = 0; i < fileSectors; i++) {
+        printf("%d ", ByteToSector(i * SectorSize));
     }
 
-    printf("\nFile contents:\n");
+    printf("\nIndirect blocks: %d %d %d\n", indirectSectors[0],
+           indirectSectors[1], indirectSectors[2]);
+    printf("File contents:\n");
 
-    for (i = k = 0; i < numSectors; i++) {
-        kernel->synchDisk->ReadSector(dataSectors[i], data);
+    for (i = k = 0; i < fileSectors; i++) {
+        int sector = ByteToSector(i * SectorSize);
+
+        if (sector == -1) {
+            memset(data, 0, SectorSize);    // a hole
+        } else {
+            kernel->synchDisk->ReadSector(sector, data);
+        }
 
         for (j = 0; (j < SectorSize) && (k < numBytes); j++, k++) {
             if ('\040' <= data[j] && data[j] <= '\176') { // isprint(data[j])
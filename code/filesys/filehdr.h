@@ -17,19 +17,32 @@
 #include "disk.h"
 #include "pbitmap.h"
 
-#define NumDirect    static_cast<int>(((SectorSize - 2 * sizeof(int)) / sizeof(int)) - 1)
-#define MaxFileSize  static_cast<int>((NumDirect * SectorSize))
+#define NumIndirectLevels   3   // single, double and triple indirect
+#define HeaderSize  MinSectorSize   // bytes of a header on disk, the
+// same whatever the sector size
+#define NumDirect    static_cast<int>((HeaderSize - 2 * sizeof(int)) / sizeof(int) - NumIndirectLevels)
+#define PointersPerSector   static_cast<int>(SectorSize / sizeof(int))
 
 // The following class defines the Nachos "file header" (in UNIX terms,
 // the "i-node"), describing where on disk to find all of the data in the file.
-// The file header is organized as a simple table of pointers to
-// data blocks.
+// The file header is organized like a UNIX i-node: a table of pointers
+// to the first NumDirect data blocks, followed by pointers to a single,
+// a double and a triple indirect block.  An indirect block is a sector
+// full of pointers, to data blocks (single), or to single (double) or
+// double (triple) indirect blocks.  With 128-byte sectors, this gives
+// files of up to about 4MB, or the whole disk if that is smaller.
 //
 // The file header data structure can be stored in memory or on disk.
-// When it is on disk, it is stored in a single sector -- this means
-// that we assume the size of this data structure to be the same
-// as one disk sector.  Without indirect addressing, this
-// limits the maximum file length to just under 4K bytes.
+// When it is on disk, it is stored in the first HeaderSize bytes of
+// a single sector; the header layout does not depend on the sector
+// size of the disk, only the number of pointers in an indirect block
+// does.  Indirect blocks are never kept in the header object; they
+// are read and written through the disk cache.
+//
+// Blocks are only allocated when they are first written; a block
+// that was never written is a "hole", recorded as sector -1, and
+// reads back as zeros.  So a file can be longer than the space
+// allocated for it, and it grows as it is written past its end.
 //
 // There is no constructor; rather the file header can be initialized
 // by allocating blocks for the file (if it is a new file), or by
@@ -39,13 +52,19 @@ class FileHeader {
 public:
     // MP4 mod tag
     FileHeader(); // dummy constructor to keep valgrind happy
-    ~FileHeader();
 
     bool Allocate(PersistentBitmap* bitMap, int fileSize);// Initialize a file header,
     //  including allocating space
     //  on disk for the file data
     void Deallocate(PersistentBitmap* bitMap);  // De-allocate this file's
     //  data blocks
+    bool AllocateRange(PersistentBitmap* bitMap, int fromSector,
+                       int toSector, int extent);
+    // Allocate the blocks for the
+    // holes among file sectors
+    // "fromSector" to "toSector",
+    // which will be followed by
+    // more up to "extent"
 
     void FetchFrom(int sectorNumber);   // Initialize file header from disk
     void WriteBack(int sectorNumber);   // Write modifications to file header
@@ -53,10 +72,11 @@ public:
 
     int ByteToSector(int offset);   // Convert a byte offset into the file
     // to the disk sector containing
-    // the byte
+    // the byte, -1 if it is in a hole
 
     int FileLength();           // Return the length of the file
     // in bytes
+    int MaxLength();            // Most bytes a file can hold
 
     void Print();           // Print the contents of the file.
 
@@ -71,17 +91,38 @@ public:
         In order to implement a data structure, you will need to add some "in-core" data
         to maintain data structure.
 
-        Disk Part - numBytes, numSectors, dataSectors occupy exactly 128 bytes and will be
-        written to a sector on disk.
-        In-core part - none
+        Disk Part - numBytes, numSectors, dataSectors, indirectSectors occupy exactly
+        HeaderSize (128) bytes and will be written to a sector on disk.
+        In-core part - sector and refCount, for the open-file table (see
+        FileSystem::AcquireHeader); indirect blocks live in the disk cache.
 
     */
 
     int numBytes;           // Number of bytes in the file
-    int numSectors;         // Number of data sectors in the file
-    int level;              // header level
+    int numSectors;         // Number of data blocks allocated
+    // to the file, holes not included
     int dataSectors[NumDirect];     // Disk sector numbers for each data
     // block in the file
+    int indirectSectors[NumIndirectLevels];
+    // Single, double and triple
+    // indirect block, -1 if none
+
+    int sector;                 // Where the header lives on disk,
+    // -1 if not known
+    int refCount;               // Open files sharing this header
+
+private:
+    int Locate(int fileSector, int* depth); // Which tree a file sector
+    // is in, and its index there
+    int Span(int depth);        // Data blocks under an indirect
+    // block "depth" levels up
+    int ReadPointer(int block, int index);
+    void WritePointer(int block, int index, int sector);
+    int NewIndirectBlock(PersistentBitmap* freeMap);
+    bool SetSector(PersistentBitmap* freeMap, int fileSector, int diskSector);
+    // Record where a file sector is,
+    // allocating indirect blocks as needed
+    void FreeTree(PersistentBitmap* freeMap, int block, int depth);
 };
 
 #endif // FILEHDR_H
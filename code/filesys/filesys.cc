@@ -12,32 +12,34 @@
 //  The file system consists of several data structures:
 //     A bitmap of free disk sectors (cf. bitmap.h)
 //     A directory of file names and file headers
+//     A journal of metadata updates (cf. journal.h)
 //
 //      Both the bitmap and the directory are represented as normal
 //  files.  Their file headers are located in specific sectors
 //  (sector 0 and sector 1), so that the file system can find them
-//  on bootup.
+//  on bootup; the journal superblock is in sector 2.
 //
 //  The file system assumes that the bitmap and directory files are
-//  kept "open" continuously while Nachos is running.
+//  kept "open" continuously while Nachos is running.  The bitmap is
+//  also read into memory once, at mount time, and that copy is the
+//  one every operation allocates from.
 //
 //  For those operations (such as Create, Remove) that modify the
 //  directory and/or bitmap, if the operation succeeds, the changes
-//  are written immediately back to disk (the two files are kept
-//  open during all this time).  If the operation fails, and we have
-//  modified part of the directory and/or bitmap, we simply discard
-//  the changed version, without writing it back to disk.
+//  are written back -- for the bitmap, only the sectors that changed
+//  -- as one journal transaction: they reach the disk together
+//  or not at all.  If the operation fails, we undo whatever it
+//  allocated in the in-memory bitmap, and simply discard the changed
+//  directory, without writing it back to disk.
 //
 //  Our implementation at this point has the following restrictions:
 //
 //     there is no synchronization for concurrent accesses
-//     files have a fixed size, set when the file is created
-//     files cannot be bigger than about 3KB in size
+//     files cannot be bigger than about 4MB in size (or the disk)
 //     there is no hierarchical directory structure, and only a limited
 //       number of files can be added to the system
-//     there is no attempt to make the system robust to failures
-//      (if Nachos exits in the middle of an operation that modifies
-//      the file system, it may corrupt the disk)
+//     only metadata is journaled: if Nachos exits in the middle of
+//      a write, the file may end up with only some of the new data
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -51,44 +53,161 @@
 #include "directory.h"
 #include "filehdr.h"
 #include "filesys.h"
+#include "journal.h"
+#include "synchdisk.h"
+#include "main.h"
 
 // Sectors containing the file headers for the bitmap of free sectors,
-// and the directory of files.  These file headers are placed in well-known
-// sectors, so that they can be located on boot-up.
+// and the directory of files, and the journal superblock.  These are
+// placed in well-known sectors, so that they can be located on boot-up.
 #define FreeMapSector       0
 #define DirectorySector     1
+#define JournalSector       2
 
-// Initial file sizes for the bitmap and directory; until the file system
-// supports extensible files, the directory size sets the maximum number
-// of files that can be loaded onto the disk.
+// Initial file sizes for the bitmap and directory.  Names are stored
+// with their length, so a new directory file holds NumDirEntries names
+// of DirNameBudget characters on average (more if the names are
+// shorter); a directory file grows when more names are added.
 #define FreeMapFileSize     (NumSectors / BitsInByte)
 #define NumDirEntries       64
-#define DirectoryFileSize   (sizeof(DirectoryEntry) * NumDirEntries)
+#define DirNameBudget       12
+#define DirectoryFileSize   (2 * sizeof(int) + \
+                             NumDirEntries * (3 * sizeof(int) + DirNameBudget))
+
+// Number of paths the path cache remembers before it starts over.
+#define PathCacheSize       256
+
+// Number of directories the directory cache holds before it starts over.
+#define DirCacheSize        32
+
+//----------------------------------------------------------------------
+// NormalizePath
+//  Copy "path" into "dest" in the form used as a path cache key:
+//  a leading '/', no repeated or trailing '/'.  The root is "/".
+//----------------------------------------------------------------------
+
+static void
+NormalizePath(char* dest, char* path) {
+    int len = 0;
+
+    for (char* p = path; *p != '\0' && len < 1022; p++) {
+        if (*p != '/' && (len == 0 || (p > path && p[-1] == '/'))) {
+            dest[len++] = '/';
+        }
+
+        if (*p != '/') {
+            dest[len++] = *p;
+        }
+    }
+
+    if (len == 0) {
+        dest[len++] = '/';
+    }
+
+    dest[len] = '\0';
+}
+
+//----------------------------------------------------------------------
+// HashPath, PathCacheKey
+//  Hash function and key extraction for the path cache.
+//----------------------------------------------------------------------
+
+static unsigned
+HashPath(PathKey key) {
+    unsigned h = 2166136261u;
+
+    for (char* p = key.path; *p != '\0'; p++) {
+        h = (h ^ (unsigned char) *p) * 16777619u;
+    }
+
+    return h;
+}
+
+static PathKey
+PathCacheKey(PathCacheEntry* entry) {
+    return PathKey(entry->path);
+}
+
+//----------------------------------------------------------------------
+// HashSector, HeaderKey, DirCacheKey
+//  Hash function and key extraction for the open-file table and the
+//  directory cache.
+//----------------------------------------------------------------------
+
+static unsigned
+HashSector(int sector) {
+    return (unsigned) sector * 2654435761u;
+}
+
+static int
+HeaderKey(FileHeader* hdr) {
+    return hdr->sector;
+}
+
+static int
+DirCacheKey(DirCacheEntry* entry) {
+    return entry->sector;
+}
+
+//----------------------------------------------------------------------
+// PathCacheEntry::PathCacheEntry
+//  Remember that "p" names the header in sector "s" (or nothing,
+//  if "s" is -1).
+//----------------------------------------------------------------------
+
+PathCacheEntry::PathCacheEntry(char* p, int s, bool dir) {
+    path = new char[strlen(p) + 1];
+    strcpy(path, p);
+    sector = s;
+    isDir = dir;
+}
+
+PathCacheEntry::~PathCacheEntry() {
+    delete [] path;
+}
+
+//----------------------------------------------------------------------
+// DirCacheEntry::DirCacheEntry
+//  Remember the directory "d", read from the open file "f", whose
+//  header is in sector "s".  The entry owns both.
+//----------------------------------------------------------------------
+
+DirCacheEntry::DirCacheEntry(OpenFile* f, int s, Directory* d) {
+    file = f;
+    sector = s;
+    directory = d;
+}
+
+DirCacheEntry::~DirCacheEntry() {
+    delete directory;
+    delete file;
+}
 
 //----------------------------------------------------------------------
 // FileSystem::FileSystem
 //  Initialize the file system.  If format = TRUE, the disk has
 //  nothing on it, and we need to initialize the disk to contain
-//  an empty directory, and a bitmap of free sectors (with almost but
-//  not all of the sectors marked as free).
+//  an empty directory, an empty journal, and a bitmap of free sectors
+//  (with almost but not all of the sectors marked as free).
 //
-//  If format = FALSE, we just have to open the files
-//  representing the bitmap and the directory.
+//  If format = FALSE, we replay the journal, in case Nachos stopped
+//  in the middle of an update, and then open the files representing
+//  the bitmap and the directory.
 //
 //  "format" -- should we initialize the disk?
 //----------------------------------------------------------------------
 
 FileSystem::FileSystem(bool format) {
     DEBUG(dbgFile, "Initializing the file system.");
+    journal = new Journal(JournalSector);
+    headerTable = new HashTable<int, FileHeader*>(HeaderKey, HashSector);
 
     if (format) {
         cout << "Formatting the file system" << endl;
-        PersistentBitmap* freeMap = new PersistentBitmap(NumSectors);
+        freeMap = new PersistentBitmap(NumSectors);
         Directory* directory = new Directory(NumDirEntries);
         FileHeader* mapHdr = new FileHeader;
         FileHeader* dirHdr = new FileHeader;
-        mapHdr->level = 1;
-        dirHdr->level = 1;
 
         DEBUG(dbgFile, "Formatting the file system.");
 
@@ -96,6 +215,17 @@ FileSystem::FileSystem(bool format) {
         // (make sure no one else grabs these!)
         freeMap->Mark(FreeMapSector);
         freeMap->Mark(DirectorySector);
+        freeMap->Mark(JournalSector);
+
+        int logSize = min(MaxJournalSize, NumSectors / 16);
+        int logStart = -1;
+
+        if (logSize < MinJournalSize) {
+            logSize = 0;        // too small a disk to journal
+        } else {
+            logStart = freeMap->FindAndSetRun(logSize);
+            ASSERT(logStart != -1);
+        }
 
         // Second, allocate space for the data blocks containing the contents
         // of the directory and bitmap files.  There better be enough space!
@@ -116,8 +246,8 @@ FileSystem::FileSystem(bool format) {
         // The file system operations assume these two files are left open
         // while Nachos is running.
 
-        freeMapFile = new OpenFile(FreeMapSector);
-        directoryFile = new OpenFile(DirectorySector);
+        freeMapFile = new OpenFile(AcquireHeader(FreeMapSector));
+        directoryFile = new OpenFile(AcquireHeader(DirectorySector));
 
         // Once we have the files "open", we can write the initial version
         // of each file back to disk.  The directory at this point is completely
@@ -134,41 +264,60 @@ FileSystem::FileSystem(bool format) {
             directory->Print();
         }
 
-        delete freeMap;
         delete directory;
         delete mapHdr;
         delete dirHdr;
+
+        journal->Format(logStart, logSize);
     } else {
-        // if we are not formatting the disk, just open the files representing
-        // the bitmap and directory; these are left open while Nachos is running
-        freeMapFile = new OpenFile(FreeMapSector);
-        directoryFile = new OpenFile(DirectorySector);
+        // if we are not formatting the disk, redo the updates in the
+        // journal, then open the files representing the bitmap and
+        // directory; these are left open while Nachos is running
+        journal->Recover();
+        freeMapFile = new OpenFile(AcquireHeader(FreeMapSector));
+        directoryFile = new OpenFile(AcquireHeader(DirectorySector));
+        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
     }
 
-    for (int i = 0; i < 20; ++i) {
-        fileDescriptorTable[i] = NULL;
-    }
+    pathCache = new HashTable<PathKey, PathCacheEntry*>(PathCacheKey, HashPath);
+    pathCacheCount = 0;
+    dirCache = new HashTable<int, DirCacheEntry*>(DirCacheKey, HashSector);
+    dirCacheCount = 0;
 }
 
 //----------------------------------------------------------------------
 // MP4 mod tag
 // FileSystem::~FileSystem
+//  Close the bitmap and directory files, commit the journal, and make
+//  sure every sector still sitting dirty in the disk cache reaches
+//  the disk.
 //----------------------------------------------------------------------
 FileSystem::~FileSystem() {
+    FlushPathCache();
+    delete pathCache;
+    FlushDirCache();
+    delete dirCache;
+
+    delete freeMap;
     delete freeMapFile;
     delete directoryFile;
+    ForgetHeaders();
+    delete headerTable;
+    journal->Checkpoint();
+    delete journal;
+    kernel->synchDisk->Sync();
 }
 
 //----------------------------------------------------------------------
 // FileSystem::Create
 //  Create a file in the Nachos file system (similar to UNIX create).
-//  Since we can't increase the size of files dynamically, we have
-//  to give Create the initial size of the file.
+//  "initialSize" only sets the length of the new file: no data
+//  blocks are allocated until the file is written, and until then
+//  the file reads as zeros.  Writing past the end makes it longer.
 //
 //  The steps to create a file are:
 //    Make sure the file doesn't already exist
 //        Allocate a sector for the file header
-//    Allocate space on disk for the data blocks for the file
 //    Add the name to the directory
 //    Store the new file header on disk
 //    Flush the changes to the bitmap and the directory back to disk
@@ -179,7 +328,7 @@ FileSystem::~FileSystem() {
 //          file is already in directory
 //      no free space for file header
 //      no free entry for file in directory
-//      no free space for data blocks for the file
+//      the file would be bigger than a file can be
 //
 //  Note that this implementation assumes there is no concurrent access
 //  to the file system!
@@ -191,144 +340,221 @@ FileSystem::~FileSystem() {
 bool
 FileSystem::Create(char* name, int initialSize) {
     cout << "Create file " << name << " with size " << initialSize << endl;
-    const int NumOfLevel1Hdr = divRoundUp(initialSize, SectorSize * NumDirect);
 
-    Directory* directory;
-    PersistentBitmap* freeMap;
     FileHeader* hdr;
-    FileHeader level1Hdr[NumDirect];
     int sector;
-    int level1Sector[NumDirect];
     bool success = TRUE;
 
     DEBUG(dbgFile, "Creating file " << name << " size " << initialSize);
 
-    directory = new Directory(NumDirEntries);
-
     char parent[1024];
     char filename[1024];
     SplitPath(name, parent, filename);
-    OpenFile* dirFile = OpenDir(parent);
+    DirCacheEntry* dir = FindDirectory(parent);
 
-    if (dirFile == NULL) {
+    if (dir == NULL) {
         return FALSE;
     }
 
-    directory->FetchFrom(dirFile);
+    journal->Begin();
+    Directory* directory = dir->directory;
+
+    hdr = new FileHeader;
+    hdr->numBytes = initialSize;
+    hdr->numSectors = 0;
 
     if (directory->Find(filename) != -1) {
         success = FALSE;    // file is already in directory
+    } else if (initialSize < 0 || initialSize > hdr->MaxLength()) {
+        success = FALSE;    // file too big
     } else {
-        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
         sector = freeMap->FindAndSet(); // find a sector to hold the file header
 
-        bool level1Flag = TRUE;
-
-        for (int i = 0; i < NumOfLevel1Hdr; ++i) {
-            level1Sector[i] = freeMap->FindAndSet();
-
-            if (level1Sector[i] == -1) {
-                level1Flag = FALSE;
-                break;
-            }
-        }
-
-        if (sector == -1 || level1Flag == FALSE) {
+        if (sector == -1) {
             success = FALSE;    // no free block for file header
         } else if (!directory->Add(filename, sector)) {
-            success = FALSE;    // no space in directory
+            success = FALSE;    // not a legal name
+            freeMap->Clear(sector);
+        } else if (!directory->WriteBack(dir->file)) {
+            success = FALSE;    // no room to extend the directory
+            ForgetDirectory(dir->sector);   // it has the name, the file not
+            freeMap->Clear(sector);
+            freeMap->WriteBack(freeMapFile);
         } else {
-            hdr = new FileHeader;
+            // everthing worked, flush all changes back to disk
+            hdr->WriteBack(sector);
+            freeMap->WriteBack(freeMapFile);
+            CachePath(name, sector, FALSE);
+        }
+    }
 
-            hdr->numBytes = initialSize;
-            hdr->numSectors = NumOfLevel1Hdr;
-            hdr->level = 0;
+    journal->End();
+    delete hdr;
+    return success;
+}
 
-            for (int i = 0; i < NumOfLevel1Hdr; ++i) {
-                hdr->dataSectors[i] = level1Sector[i];
-            }
+//----------------------------------------------------------------------
+// FileSystem::AcquireHeader
+//  Return the in-core header of the file whose header is in "sector",
+//  with a reference taken on it for the caller.  If the file is open
+//  already, this is the header its open files share; otherwise it is
+//  read from disk and entered in the open-file table.
+//----------------------------------------------------------------------
 
-            int remainFileSize = initialSize;
-            int level1HdrIdx = 0;
+FileHeader*
+FileSystem::AcquireHeader(int sector) {
+    FileHeader* hdr;
 
-            while (remainFileSize > 0) {
-                int toRequest = (remainFileSize >= NumDirect * SectorSize) ? NumDirect * SectorSize : remainFileSize;
-                remainFileSize -= toRequest;
-                level1Hdr[level1HdrIdx].level = 1;
+    if (!headerTable->Find(sector, &hdr)) {
+        hdr = new FileHeader;
+        hdr->FetchFrom(sector);
+        hdr->sector = sector;
+        headerTable->Insert(hdr);
+    }
 
-                if (!level1Hdr[level1HdrIdx++].Allocate(freeMap, toRequest)) {
-                    success = FALSE;
-                }
-            }
+    hdr->refCount++;
+    return hdr;
+}
 
-            if (success == TRUE) {
-                // everthing worked, flush all changes back to disk
-                hdr->WriteBack(sector);
+//----------------------------------------------------------------------
+// FileSystem::ReleaseHeader
+//  Drop a reference to an in-core header obtained from AcquireHeader.
+//  The last one takes it out of the open-file table (unless the file
+//  was removed, and it has been taken out already) and frees it.
+//----------------------------------------------------------------------
 
-                for (int i = 0; i < NumOfLevel1Hdr; ++i) {
-                    level1Hdr[i].WriteBack(level1Sector[i]);
-                }
+void
+FileSystem::ReleaseHeader(FileHeader* hdr) {
+    FileHeader* entry;
 
-                directory->WriteBack(dirFile);
-                freeMap->WriteBack(freeMapFile);
-            }
+    ASSERT(hdr->refCount > 0);
+    if (--hdr->refCount > 0) {
+        return;
+    }
 
-            delete hdr;
-        }
+    if (headerTable->Find(hdr->sector, &entry) && entry == hdr) {
+        headerTable->Remove(hdr->sector);
+    }
+
+    delete hdr;
+}
 
-        delete freeMap;
+//----------------------------------------------------------------------
+// FileSystem::ForgetHeader
+//  Take the header in "sector" out of the open-file table, because the
+//  file is being removed and the sector may soon hold another header.
+//  Files that still have it open keep their reference.
+//----------------------------------------------------------------------
+
+void
+FileSystem::ForgetHeader(int sector) {
+    if (headerTable->IsInTable(sector)) {
+        headerTable->Remove(sector);
     }
+}
 
-    delete dirFile;
-    delete directory;
+//----------------------------------------------------------------------
+// FileSystem::ForgetHeaders
+//  Empty the open-file table when the file system goes away.  Files
+//  that user programs still have open at that point (a program that
+//  called Halt without closing them, say) are never closed, so their
+//  headers are simply freed.
+//----------------------------------------------------------------------
+
+void
+FileSystem::ForgetHeaders() {
+    ::List<FileHeader*> doomed;
+    HashIterator<int, FileHeader*> iter(headerTable);
+
+    for (; !iter.IsDone(); iter.Next()) {
+        doomed.Append(iter.Item());
+    }
+
+    while (!doomed.IsEmpty()) {
+        FileHeader* hdr = doomed.RemoveFront();
+        headerTable->Remove(hdr->sector);
+        delete hdr;
+    }
+}
+
+//----------------------------------------------------------------------
+// FileSystem::AllocateBlocks
+//  Allocate disk blocks for the holes among file sectors "fromSector"
+//  through "toSector" of the file whose header is "hdr", and write
+//  the free map and the header (to "hdrSector") back, as one journal
+//  operation.  Called by OpenFile when a write reaches parts of a
+//  file that have no blocks yet; the write goes on to file sector
+//  "extent", and the blocks are placed so that the rest can follow.
+//
+//  Return FALSE if the disk filled up; whatever was allocated until
+//  then is kept.
+//----------------------------------------------------------------------
+
+bool
+FileSystem::AllocateBlocks(FileHeader* hdr, int hdrSector,
+                           int fromSector, int toSector, int extent) {
+    journal->Begin();
+    bool success = hdr->AllocateRange(freeMap, fromSector, toSector, extent);
+
+    freeMap->WriteBack(freeMapFile);
+    hdr->WriteBack(hdrSector);
+    journal->End();
     return success;
 }
 
 bool
 FileSystem::CreateDirectory(char* name, char* parent) {
-    Directory* directory;
-    PersistentBitmap* freeMap;
     FileHeader* dirHdr;
     int sector;
     bool success = TRUE;
 
     DEBUG(dbgFile, "Creating directory " << name);
 
-    directory = new Directory(NumDirEntries);
-    OpenFile* dirFile = OpenDir(parent);
+    DirCacheEntry* dir = FindDirectory(parent);
 
-    if (dirFile == NULL) {
+    if (dir == NULL) {
         return FALSE;
     }
 
-    directory->FetchFrom(dirFile);
+    journal->Begin();
+    Directory* directory = dir->directory;
 
     if (directory->Find(name) != -1) {
         success = FALSE;
     } else {
         cout << "Creating directory " << name << " under " << parent << endl;
-        freeMap = new PersistentBitmap(freeMapFile, NumSectors);
         sector = freeMap->FindAndSet();
 
         if (sector == -1) {
             success = FALSE;
         } else if (!directory->AddDir(name, sector)) {
             success = FALSE;
+            freeMap->Clear(sector);
         } else {
             dirHdr = new FileHeader;
 
-            dirHdr->level = 1;
-
             if (!dirHdr->Allocate(freeMap, DirectoryFileSize)) {
-                success = FALSE;
+                success = FALSE;    // no room for the new directory
+                ForgetDirectory(dir->sector);
+                dirHdr->Deallocate(freeMap);
+                freeMap->Clear(sector);
+            } else if (!directory->WriteBack(dir->file)) {
+                success = FALSE;    // no room to extend the parent
+                ForgetDirectory(dir->sector);
+                dirHdr->Deallocate(freeMap);
+                freeMap->Clear(sector);
+                freeMap->WriteBack(freeMapFile);
             } else {
                 success = TRUE;
                 dirHdr->WriteBack(sector);
-                directory->WriteBack(dirFile);
                 freeMap->WriteBack(freeMapFile);
 
+                char path[1024];
+                JoinPath(path, parent, name);
+                CachePath(path, sector, TRUE);
+
                 Directory* newDirectory = new Directory(NumDirEntries);
-                OpenFile* newDirFile = new OpenFile(sector);
+                OpenFile* newDirFile = new OpenFile(AcquireHeader(sector));
                 newDirectory->WriteBack(newDirFile);
                 delete newDirFile;
                 delete newDirectory;
@@ -336,41 +562,266 @@ FileSystem::CreateDirectory(char* name, char* parent) {
 
             delete dirHdr;
         }
-
-        delete freeMap;
     }
 
-    delete dirFile;
-    delete directory;
+    journal->End();
     return success;
 }
 
+//----------------------------------------------------------------------
+// FileSystem::OpenDir
+//  Open the directory (or file) named by the absolute path "inpath".
+//  Return NULL if there is no such path.
+//----------------------------------------------------------------------
+
 OpenFile*
 FileSystem::OpenDir(char* inpath) {
-    char path[1024];
-    strncpy(path, inpath, 1024);
-    Directory* directory = new Directory(NumDirEntries);
-    directory->FetchFrom(directoryFile);
-    char* split;
-    int sector = 1;
-    split = strtok(path, "/");
+    bool isDir;
+    int sector = LookupPath(inpath, &isDir);
+
+    if (sector == -1) {
+        return NULL;
+    }
 
-    while (split != NULL) {
-        sector = directory->Find(split);
+    return new OpenFile(AcquireHeader(sector));
+}
 
-        if (sector == -1) {
-            return NULL;
+//----------------------------------------------------------------------
+// FileSystem::LookupPath
+//  Return the sector of the header of the file or directory named
+//  by "path", or -1 if there is none; "isDir" says which it is.
+//
+//  Each prefix of the path is looked up in the path cache first;
+//  the directories holding the prefixes that are not cached are
+//  searched, from the directory cache, and every prefix resolved
+//  this way (including one that turns out not to exist) is added
+//  to the path cache.
+//
+//  "path" -- the absolute path to resolve
+//  "isDir" -- set to TRUE if the path names a directory
+//----------------------------------------------------------------------
+
+int
+FileSystem::LookupPath(char* path, bool* isDir) {
+    char norm[1024];
+    char prefix[1024];
+    PathCacheEntry* entry;
+    int sector = DirectorySector;
+
+    NormalizePath(norm, path);
+    *isDir = TRUE;
+
+    if (pathCache->Find(PathKey(norm), &entry)) {
+        *isDir = entry->isDir;
+        return entry->sector;
+    }
+
+    int length = strlen(norm);
+    int start = 1;              // where the current component begins
+
+    for (int i = 1; length > 1 && i <= length; i++) {
+        if (norm[i] != '/' && norm[i] != '\0') {
+            continue;
+        }
+
+        // "prefix" is the path up to the end of the component that
+        // starts at "start"
+        memcpy(prefix, norm, i);
+        prefix[i] = '\0';
+        char* component = prefix + start;
+        start = i + 1;
+
+        if (!*isDir) {                  // can't look inside a file
+            sector = -1;
+            break;
+        }
+
+        if (pathCache->Find(PathKey(prefix), &entry)) {
+            sector = entry->sector;
+            *isDir = entry->isDir;
         } else {
-            OpenFile* dirFile = new OpenFile(sector);
-            directory->FetchFrom(dirFile);
-            delete dirFile;
+            Directory* directory = FetchDirectory(sector)->directory;
+            int index = directory->FindIndex(component);
+
+            if (index == -1) {
+                sector = -1;
+                *isDir = FALSE;
+            } else {
+                sector = directory->table[index].sector;
+                *isDir = directory->table[index].type;
+            }
+
+            CachePath(prefix, sector, *isDir);
         }
 
-        split = strtok(split + strlen(split) + 1, "/");
+        if (sector == -1) {
+            break;
+        }
     }
 
-    delete directory;
-    return new OpenFile(sector);
+    return sector;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::CachePath
+//  Record in the path cache that "path" resolves to "sector" (-1 if
+//  it does not exist), replacing what was known about it.  When the
+//  cache is full it is emptied first.
+//----------------------------------------------------------------------
+
+void
+FileSystem::CachePath(char* path, int sector, bool isDir) {
+    char norm[1024];
+    PathCacheEntry* entry;
+
+    NormalizePath(norm, path);
+
+    if (pathCache->Find(PathKey(norm), &entry)) {
+        entry->sector = sector;
+        entry->isDir = isDir;
+        return;
+    }
+
+    if (pathCacheCount >= PathCacheSize) {
+        FlushPathCache();
+    }
+
+    pathCache->Insert(new PathCacheEntry(norm, sector, isDir));
+    pathCacheCount++;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::InvalidatePath
+//  Drop "path" and every path beneath it from the path cache.
+//----------------------------------------------------------------------
+
+void
+FileSystem::InvalidatePath(char* path) {
+    char norm[1024];
+    ::List<PathCacheEntry*> doomed;     // "List" alone names FileSystem::List
+    HashIterator<PathKey, PathCacheEntry*> iter(pathCache);
+
+    NormalizePath(norm, path);
+    int len = strlen(norm);
+
+    if (len == 1) {             // the root: everything goes
+        len = 0;
+    }
+
+    for (; !iter.IsDone(); iter.Next()) {
+        char* p = iter.Item()->path;
+
+        if (strncmp(p, norm, len) == 0 && (p[len] == '\0' || p[len] == '/')) {
+            doomed.Append(iter.Item());
+        }
+    }
+
+    while (!doomed.IsEmpty()) {
+        PathCacheEntry* entry = doomed.RemoveFront();
+        pathCache->Remove(PathKey(entry->path));
+        pathCacheCount--;
+        delete entry;
+    }
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FlushPathCache
+//  Empty the path cache.
+//----------------------------------------------------------------------
+
+void
+FileSystem::FlushPathCache() {
+    char root[] = "/";
+
+    InvalidatePath(root);
+    ASSERT(pathCacheCount == 0);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FindDirectory
+//  Return the directory named by the absolute path "path", from the
+//  directory cache, or NULL if there is no such directory.
+//----------------------------------------------------------------------
+
+DirCacheEntry*
+FileSystem::FindDirectory(char* path) {
+    bool isDir;
+    int sector = LookupPath(path, &isDir);
+
+    if (sector == -1 || !isDir) {
+        return NULL;
+    }
+
+    return FetchDirectory(sector);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FetchDirectory
+//  Return the directory whose header is in "sector".  If it is not in
+//  the directory cache, it is read from disk and added; when the cache
+//  is full it is emptied first.  The entry stays valid until the next
+//  directory is fetched, or it is forgotten.
+//----------------------------------------------------------------------
+
+DirCacheEntry*
+FileSystem::FetchDirectory(int sector) {
+    DirCacheEntry* entry;
+
+    if (dirCache->Find(sector, &entry)) {
+        return entry;
+    }
+
+    if (dirCacheCount >= DirCacheSize) {
+        FlushDirCache();
+    }
+
+    OpenFile* file = new OpenFile(AcquireHeader(sector));
+    Directory* directory = new Directory(NumDirEntries);
+
+    directory->FetchFrom(file);
+    entry = new DirCacheEntry(file, sector, directory);
+    dirCache->Insert(entry);
+    dirCacheCount++;
+    return entry;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::ForgetDirectory
+//  Drop the directory whose header is in "sector" from the directory
+//  cache: it is being removed, or its cached contents were changed
+//  and could not be written back.
+//----------------------------------------------------------------------
+
+void
+FileSystem::ForgetDirectory(int sector) {
+    DirCacheEntry* entry;
+
+    if (dirCache->Find(sector, &entry)) {
+        dirCache->Remove(sector);
+        dirCacheCount--;
+        delete entry;
+    }
+}
+
+//----------------------------------------------------------------------
+// FileSystem::FlushDirCache
+//  Empty the directory cache.
+//----------------------------------------------------------------------
+
+void
+FileSystem::FlushDirCache() {
+    ::List<DirCacheEntry*> doomed;
+    HashIterator<int, DirCacheEntry*> iter(dirCache);
+
+    for (; !iter.IsDone(); iter.Next()) {
+        doomed.Append(iter.Item());
+    }
+
+    while (!doomed.IsEmpty()) {
+        ForgetDirectory(doomed.RemoveFront()->sector);
+    }
+
+    ASSERT(dirCacheCount == 0);
 }
 
 //----------------------------------------------------------------------
@@ -378,39 +829,63 @@ FileSystem::OpenDir(char* inpath) {
 //  Open a file for reading and writing.
 //  To open a file:
 //    Find the location of the file's header, using the directory
-//    Bring the header into memory
+//    Bring the header into memory, unless the file is open already
 //
 //  "name" -- the text name of the file to be opened
 //----------------------------------------------------------------------
 
 OpenFile*
 FileSystem::Open(char* name) {
-    Directory* directory = new Directory(NumDirEntries);
     OpenFile* openFile = NULL;
+    bool isDir;
     int sector;
 
     DEBUG(dbgFile, "Opening file" << name);
 
-    char parent[1024];
-    char filename[1024];
-    SplitPath(name, parent, filename);
-    OpenFile* dirFile = OpenDir(parent);
+    sector = LookupPath(name, &isDir);
 
-    if (dirFile == NULL) {
-        return NULL;
+    if (sector >= 0) {
+        openFile = new OpenFile(AcquireHeader(sector));    // name was found in directory
     }
 
-    directory->FetchFrom(dirFile);
-    delete dirFile;
+    return openFile;                // return NULL if not found
+}
 
-    sector = directory->Find(filename);
+//----------------------------------------------------------------------
+// WalkFrame
+//  A directory being walked by RemoveTree or RecursiveList: the
+//  directory file, kept open while the walk is inside it, its
+//  contents, and how far through them the walk has got.
+//----------------------------------------------------------------------
 
-    if (sector >= 0) {
-        openFile = new OpenFile(sector);    // name was found in directory
-    }
+class WalkFrame {
+public:
+    WalkFrame(OpenFile* f, int s, char* p);
+    ~WalkFrame();
+
+    OpenFile* file;             // The directory file
+    int sector;                 // Where its header is
+    Directory* directory;       // Its contents
+    int next;                   // Next table index to look at
+    int remaining;              // Entries not visited yet
+    char* path;                 // Its path, for messages
+};
+
+WalkFrame::WalkFrame(OpenFile* f, int s, char* p) {
+    file = f;
+    sector = s;
+    directory = new Directory(NumDirEntries);
+    directory->FetchFrom(file);
+    next = 0;
+    remaining = directory->NumEntries();
+    path = new char[strlen(p) + 1];
+    strcpy(path, p);
+}
 
+WalkFrame::~WalkFrame() {
     delete directory;
-    return openFile;                // return NULL if not found
+    delete file;
+    delete [] path;
 }
 
 //----------------------------------------------------------------------
@@ -421,17 +896,25 @@ FileSystem::Open(char* name) {
 //      Delete the space for its data blocks
 //      Write changes to directory, bitmap back to disk
 //
+//  A directory must be empty, unless "recur" is set, in which case
+//  everything beneath it is deleted too (see RemoveTree).
+//
+//  The name is taken out of the directory first, and then the files
+//  are freed one at a time, each a step of its own that the journal
+//  may commit separately, so that removing a big file or a whole tree
+//  never needs more than the journal can commit at once.  A crash in
+//  the middle leaves the name gone and some blocks not freed yet,
+//  never a name that points at freed blocks.
+//
 //  Return TRUE if the file was deleted, FALSE if the file wasn't
 //  in the file system.
 //
 //  "name" -- the text name of the file to be removed
+//  "recur" -- remove a directory with everything in it
 //----------------------------------------------------------------------
 
 bool
 FileSystem::Remove(char* name, bool recur) {
-    Directory* directory;
-    PersistentBitmap* freeMap;
-    FileHeader* fileHdr;
     int sector;
     int tableIdx;
 
@@ -439,90 +922,147 @@ FileSystem::Remove(char* name, bool recur) {
     char parent[1024];
     SplitPath(name, parent, filename);
 
-    directory = new Directory(NumDirEntries);
-    OpenFile* dirFile = OpenDir(parent);
+    DirCacheEntry* dir = FindDirectory(parent);
 
-    if (dirFile == NULL) {
+    if (dir == NULL) {
         cout << "Directory " << parent << " not found!" << endl;
-        delete directory;
         return FALSE;
     }
 
-    directory->FetchFrom(dirFile);
+    Directory* directory = dir->directory;
     sector = directory->Find(filename);
     tableIdx = directory->FindIndex(filename);
 
     if (sector == -1) {
         cout << "File " << filename << " not found!" << endl;
-        delete directory;
-        delete dirFile;
         return FALSE;             // file not found
     }
 
-    fileHdr = new FileHeader;
-    fileHdr->FetchFrom(sector);
+    journal->Begin();
 
-    freeMap = new PersistentBitmap(freeMapFile, NumSectors);
+    WalkFrame* top = NULL;
 
     cout << "Remove " << name;
     if (directory->table[tableIdx].type) {
         cout << "  (directory)" << endl;
-        // is a directory, delete all files under it
-        OpenFile* nextDirFile = OpenDir(name);
-        Directory* nextDir = new Directory(NumDirEntries);
-        nextDir->FetchFrom(nextDirFile);
-        int totalCount = 0;
-
-        for (int i = 0; i < nextDir->tableSize; ++i) {
-            if (nextDir->table[i].inUse) {
-                ++totalCount;
-            }
-        }
+        top = new WalkFrame(new OpenFile(AcquireHeader(sector)), sector, name);
 
-        if (recur == FALSE && totalCount != 0) {
+        if (recur == FALSE && top->remaining != 0) {
             cout << filename << ": directory not empty!" << endl;
-            delete directory;
-            delete dirFile;
-            delete fileHdr;
-            delete nextDir;
+            journal->End();
+            delete top;
             return FALSE;
         }
+    } else {
+        cout << "  (regular file)" << endl;
+    }
 
-        for (int i = 0; i < nextDir->tableSize; ++i) {
-            if (nextDir->table[i].inUse) {
-                char nextFilename[1024];
-                JoinPath(nextFilename, name, nextDir->table[i].name);
-                Remove(nextFilename, recur);
-            }
-        }
+    directory->Remove(filename);
+    InvalidatePath(name);
+    directory->WriteBack(dir->file);      // flush to disk
 
-        delete nextDir;
+    if (top != NULL) {
+        RemoveTree(top);        // deletes the directory itself too
     } else {
-        cout << "  (regular file)" << endl;
+        FreeFile(sector);
+        EndStep();
     }
 
-    if (fileHdr->level == 0) {
-        for (int i = 0; i < fileHdr->numSectors; ++i) {
-            FileHeader* level1Hdr = new FileHeader;
-            level1Hdr->FetchFrom(fileHdr->dataSectors[i]);
-            level1Hdr->Deallocate(freeMap);
-            // don't clean header sector, let it to be cleaned by level 0
-            // freeMap->Clear(fileHdr->dataSectors[i]);
-            delete level1Hdr;
+    journal->End();
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// FileSystem::RemoveTree
+//  Delete the directory "top", already read in, and everything
+//  beneath it, in the same order a recursive removal would: each
+//  file or directory is announced before anything under it.
+//
+//  The walk is iterative, with a stack of the directories it is in,
+//  and goes down by the header sectors in the directory entries, so
+//  each directory is read once, and no path is looked up.  Nothing
+//  under "top" is written: the directories are deleted whole, so the
+//  only thing that changes is the free map, written back after each
+//  file is freed (see EndStep).  The caller has already taken "top"
+//  out of the directory holding it.
+//----------------------------------------------------------------------
+
+void
+FileSystem::RemoveTree(WalkFrame* top) {
+    ::List<WalkFrame*> stack;
+    char path[1024];
+
+    stack.Prepend(top);
+
+    while (!stack.IsEmpty()) {
+        WalkFrame* frame = stack.Front();
+
+        if (frame->remaining == 0) {    // everything under it is gone
+            stack.RemoveFront();
+            FreeFile(frame->sector);
+            EndStep();
+            delete frame;
+            continue;
+        }
+
+        DirectoryEntry* entry = &frame->directory->table[frame->next++];
+        if (!entry->inUse) {
+            continue;
+        }
+
+        frame->remaining--;
+        JoinPath(path, frame->path, entry->name);
+        cout << "Remove " << path;
+
+        if (entry->type) {
+            cout << "  (directory)" << endl;
+            stack.Prepend(new WalkFrame(new OpenFile(AcquireHeader(entry->sector)),
+                                        entry->sector, path));
+        } else {
+            cout << "  (regular file)" << endl;
+            FreeFile(entry->sector);
+            EndStep();
         }
     }
+}
 
-    fileHdr->Deallocate(freeMap);       // remove data blocks
-    freeMap->Clear(sector);         // remove header block
-    directory->Remove(filename);
+//----------------------------------------------------------------------
+// FileSystem::FreeFile
+//  Give back to the in-memory free map the header sector and every
+//  block of the file or directory whose header is in "sector", and
+//  take its header out of the open-file table, and the directory
+//  cache if it is there.
+//----------------------------------------------------------------------
 
-    freeMap->WriteBack(freeMapFile);        // flush to disk
-    directory->WriteBack(dirFile);        // flush to disk
-    delete fileHdr;
-    delete dirFile;
-    delete directory;
-    delete freeMap;
-    return TRUE;
+void
+FileSystem::FreeFile(int sector) {
+    ForgetDirectory(sector);
+    FileHeader* hdr = AcquireHeader(sector);
+
+    hdr->Deallocate(freeMap);           // remove data blocks
+    freeMap->Clear(sector);             // remove header block
+    ForgetHeader(sector);
+    ReleaseHeader(hdr);
+}
+
+//----------------------------------------------------------------------
+// FileSystem::EndStep
+//  Called by a removal, within a journal operation, after freeing a
+//  file: write the free map back, and end the operation and begin
+//  it again, so the journal can commit what was freed so far.  A big
+//  file may have changed more of the map than one step can hold; it
+//  is then written back over several.
+//----------------------------------------------------------------------
+
+void
+FileSystem::EndStep() {
+    bool done;
+
+    do {
+        done = freeMap->WriteBack(freeMapFile, MaxStepSectors / 2);
+        journal->End();
+        journal->Begin();
+    } while (!done);
 }
 
 //----------------------------------------------------------------------
@@ -532,81 +1072,83 @@ FileSystem::Remove(char* name, bool recur) {
 
 void
 FileSystem::List(char* listDirectoryName) {
-    Directory* directory = new Directory(NumDirEntries);
-    OpenFile* dirFile = OpenDir(listDirectoryName);
+    DirCacheEntry* dir = FindDirectory(listDirectoryName);
 
-    if (dirFile == NULL) {
+    if (dir == NULL) {
         cout << listDirectoryName << ": no such file or directory" << endl;
-        delete directory;
         return;
     }
 
     cout << "List directory " << listDirectoryName << endl;
-
-    directory->FetchFrom(dirFile);
-    directory->List();
-    delete dirFile;
-    delete directory;
+    dir->directory->List();
 }
 
-void
-FileSystem::RecursiveList(char* listDirectoryName, int tab) {
-    if (tab == 4) {
-        memset(isLast, 0, sizeof(bool) * 1024);
-    }
+//----------------------------------------------------------------------
+// FileSystem::RecursiveList
+//  Print the tree of files and directories under "listDirectoryName",
+//  one per line, indented by depth.
+//
+//  Like RemoveTree, the walk keeps a stack of the directories it is
+//  in and goes down by header sector, reading each directory once.
+//  isLast[d] says whether the entry being listed at depth d was the
+//  last one of its directory, which decides how the lines beneath it
+//  are drawn.
+//----------------------------------------------------------------------
 
-    Directory* directory = new Directory(NumDirEntries);
+void
+FileSystem::RecursiveList(char* listDirectoryName) {
+    ::List<WalkFrame*> stack;
     OpenFile* dirFile = OpenDir(listDirectoryName);
 
     if (dirFile == NULL) {
         cout << listDirectoryName << ": no such file or directory" << endl;
-        delete directory;
         return;
     }
 
-    directory->FetchFrom(dirFile);
-    int totalCount = 0;
+    memset(isLast, 0, sizeof(isLast));
+    stack.Prepend(new WalkFrame(dirFile, -1, listDirectoryName));
+
+    while (!stack.IsEmpty()) {
+        WalkFrame* frame = stack.Front();
 
-    for (int i = 0; i < directory->tableSize; ++i) {
-        if (directory->table[i].inUse) {
-            ++totalCount;
+        if (frame->remaining == 0) {
+            delete stack.RemoveFront();
+            continue;
         }
-    }
 
-    for (int i = 0; i < directory->tableSize; ++i) {
-        if (directory->table[i].inUse) {
-            --totalCount;
+        DirectoryEntry* entry = &frame->directory->table[frame->next++];
+        if (!entry->inUse) {
+            continue;
+        }
 
-            for (int j = 0; j < tab / 4 - 1; ++j) {
-                if (!isLast[j]) {
-                    cout << "│   ";
-                } else {
-                    cout << "    ";
-                }
-            }
+        int depth = stack.NumInList() - 1;
+        frame->remaining--;
 
-            if (totalCount) {
-                cout << "├──";
+        for (int j = 0; j < depth; ++j) {
+            if (!isLast[j]) {
+                cout << "│   ";
             } else {
-                cout << "└──";
+                cout << "    ";
             }
+        }
 
-            cout << (directory->table[i].type ? "\x1B[1;34m" : "");
-            cout << directory->table[i].name;
-            cout << (directory->table[i].type ? "/" : "");
-            cout << "\x1B[0m" << endl;
+        if (frame->remaining) {
+            cout << "├──";
+        } else {
+            cout << "└──";
+        }
 
-            if (directory->table[i].type) {
-                char nextDir[1024];
-                JoinPath(nextDir, listDirectoryName, directory->table[i].name);
-                isLast[tab / 4 - 1] = totalCount == 0;
-                RecursiveList(nextDir, tab + 4);
-            }
+        cout << (entry->type ? "\x1B[1;34m" : "");
+        cout << entry->name;
+        cout << (entry->type ? "/" : "");
+        cout << "\x1B[0m" << endl;
+
+        if (entry->type && depth + 1 < MaxListDepth) {
+            isLast[depth] = frame->remaining == 0;
+            stack.Prepend(new WalkFrame(new OpenFile(AcquireHeader(entry->sector)),
+                                        entry->sector, entry->name));
         }
     }
-
-    delete dirFile;
-    delete directory;
 }
 
 //----------------------------------------------------------------------
@@ -623,7 +1165,6 @@ void
 FileSystem::Print() {
     FileHeader* bitHdr = new FileHeader;
     FileHeader* dirHdr = new FileHeader;
-    PersistentBitmap* freeMap = new PersistentBitmap(freeMapFile, NumSectors);
     Directory* directory = new Directory(NumDirEntries);
 
     printf("Bit map file header:\n");
@@ -641,49 +1182,9 @@ FileSystem::Print() {
 
     delete bitHdr;
     delete dirHdr;
-    delete freeMap;
     delete directory;
 }
 
-int FileSystem::Open(char* name, int unused) {
-    OpenFile* fp = Open(name);
-
-    for (int i = 1; i < 20; ++i) {
-        if (fileDescriptorTable[i] == NULL) {
-            fileDescriptorTable[i] = fp;
-            return i;
-        }
-    }
-
-    return -1;
-}
-
-int FileSystem::Write(char* buffer, int size, int fileid) {
-    if (fileDescriptorTable[fileid] == NULL) {
-        return -1;
-    }
-
-    return fileDescriptorTable[fileid]->Write(buffer, size);
-}
-
-int FileSystem::Read(char* buffer, int size, int fileid) {
-    if (fileDescriptorTable[fileid] == NULL) {
-        return -1;
-    }
-
-    return fileDescriptorTable[fileid]->Read(buffer, size);
-}
-
-int FileSystem::Close(int fileid) {
-    if (fileDescriptorTable[fileid] == NULL) {
-        return 0;
-    }
-
-    delete fileDescriptorTable[fileid];
-    fileDescriptorTable[fileid] = NULL;
-    return 1;
-}
-
 void FileSystem::SplitPath(char* fullpath, char* parent, char* name) {
     strncpy(parent, fullpath, 1024);
 
@@ -36,17 +36,20 @@
 #include "copyright.h"
 #include "sysdep.h"
 #include "openfile.h"
+#include "hash.h"
+
+class Directory;
+class FileHeader;
+class Journal;
+class PersistentBitmap;
+class WalkFrame;
 
 #ifdef FILESYS_STUB         // Temporarily implement file system calls as
 // calls to UNIX, until the real file system
 // implementation is available
 class FileSystem {
 public:
-    FileSystem() {
-        for (int i = 0; i < 20; i++) {
-            fileDescriptorTable[i] = NULL;
-        }
-    }
+    FileSystem() {}
 
     bool Create(char* name) {
         int fileDescriptor = OpenForWrite(name);
@@ -69,58 +72,63 @@ public:
         return new OpenFile(fileDescriptor);
     }
 
-    int Open(char* name, int unused) {
-        int fileid = OpenForReadWrite(name, FALSE);
+    bool Remove(char* name) {
+        return Unlink(name) == 0;
+    }
+};
 
-        if (fileid == -1) {
-            return -1;
-        }
+#else // FILESYS
 
-        if (fileid >= 20) {
-            cerr << "fd >= 20!!!" << endl;
-            ::Close(fileid);
-            return -1;
-        }
+// The key of the path cache: a normalized absolute path.  Keys are
+// compared by contents, so a lookup can use a temporary string.
 
-        fileDescriptorTable[fileid] = new OpenFile(fileid);
-        return fileid;
+class PathKey {
+public:
+    PathKey(char* p) {
+        path = p;
     }
-
-    int Write(char* buffer, int size, int fileid) {
-        if (fileDescriptorTable[fileid] == NULL) {
-            return -1;
-        }
-
-        return fileDescriptorTable[fileid]->Write(buffer, size);
+    bool operator==(const PathKey& other) const {
+        return strcmp(path, other.path) == 0;
     }
 
-    int Read(char* buffer, int size, int fileid) {
-        if (fileDescriptorTable[fileid] == NULL) {
-            return -1;
-        }
+    char* path;
+};
 
-        return fileDescriptorTable[fileid]->Read(buffer, size);
-    }
+// An entry of the path cache: where the header of the file or
+// directory named "path" is, or a sector of -1 if nothing by that
+// name exists.
 
-    int Close(int fileid) {
-        if (fileDescriptorTable[fileid] == NULL) {
-            return 0;
-        }
+class PathCacheEntry {
+public:
+    PathCacheEntry(char* p, int s, bool dir);
+    ~PathCacheEntry();
 
-        delete fileDescriptorTable[fileid];
-        fileDescriptorTable[fileid] = NULL;
-        return 1;
-    }
+    char* path;             // Normalized absolute path
+    int sector;             // Header sector, -1 for "not found"
+    bool isDir;             // Is it a directory?
+};
 
-    bool Remove(char* name) {
-        return Unlink(name) == 0;
-    }
+// An entry of the directory cache: the directory whose header is in
+// "sector", open, and its contents as read from disk.
 
-    OpenFile* fileDescriptorTable[20];
+class DirCacheEntry {
+public:
+    DirCacheEntry(OpenFile* f, int s, Directory* d);
+    ~DirCacheEntry();
 
+    OpenFile* file;             // The directory file
+    int sector;                 // Where its header is
+    Directory* directory;       // Its contents
 };
 
-#else // FILESYS
+// Deepest level of the tree RecursiveList goes down to.
+#define MaxListDepth        1024
+
+// File sectors a write gives blocks to in one journal operation; with
+// the indirect blocks, free map and header sectors that change along
+// with them, that stays within MaxStepSectors.
+#define AllocateStep        4
+
 class FileSystem {
 public:
     FileSystem(bool format);        // Initialize the file system.
@@ -139,35 +147,87 @@ public:
 
     OpenFile* OpenDir(char* inpath);
 
+    FileHeader* AcquireHeader(int sector);  // Get the in-core header
+    // stored in "sector", shared with
+    // everyone who has it open
+    void ReleaseHeader(FileHeader* hdr);    // Drop a reference to it
+
+    bool AllocateBlocks(FileHeader* hdr, int hdrSector,
+                        int fromSector, int toSector, int extent);
+    // Give a file blocks for the sectors
+    // it is about to be written to
+
     OpenFile* Open(char* name);     // Open a file (UNIX open)
 
     bool Remove(char* name, bool recur);        // Delete a file (UNIX unlink)
 
     void List(char* listDirectoryName);            // List all the files in the file system
 
-    void RecursiveList(char* listDirectoryName, int tab = 4); // List all the files in the file system
+    void RecursiveList(char* listDirectoryName); // List all the files in the file system
 
     void Print();           // List all the files and their contents
 
-    int Open(char* name, int unused);
-
-    int Write(char* buffer, int size, int fileid);
-
-    int Read(char* buffer, int size, int fileid);
-
-    int Close(int fileid);
-
     void SplitPath(char* fullpath, char* parent, char* name);
 
     void JoinPath(char* dest, char* parent, char* name);
 
-    OpenFile* fileDescriptorTable[20];
+    Journal* journal;           // Log of metadata updates
 
 private:
-    bool isLast[1024];
+    bool isLast[MaxListDepth];  // Per depth, for RecursiveList: was
+    // the entry listed there the last
+    // one of its directory?
+
+    void RemoveTree(WalkFrame* top);    // Delete a directory and
+    // everything beneath it
+    void FreeFile(int sector);  // Free a file's header and blocks
+    void EndStep();             // Write the free map back between
+    // two steps of a removal
+
+    // Path cache: maps paths already resolved by OpenDir or Open to
+    // the sector of their header, so that a repeated lookup costs a
+    // hash probe instead of reading every directory along the path.
+    HashTable<PathKey, PathCacheEntry*>* pathCache;
+    int pathCacheCount;         // Entries in the path cache
+
+    int LookupPath(char* path, bool* isDir);
+    // Resolve "path" to a header sector,
+    // or -1 if it does not exist
+    void CachePath(char* path, int sector, bool isDir);
+    void InvalidatePath(char* path);    // Forget "path" and everything
+    // beneath it
+    void FlushPathCache();      // Forget everything
+
+    // Directory cache: the contents of directories already read, by
+    // header sector, so that an operation on a directory does not read
+    // and parse the whole directory file again.  Directory::WriteBack
+    // keeps a cached directory the same as its file.
+    HashTable<int, DirCacheEntry*>* dirCache;
+    int dirCacheCount;          // Entries in the directory cache
+
+    DirCacheEntry* FindDirectory(char* path);
+    // The directory named "path", or
+    // NULL if there is none
+    DirCacheEntry* FetchDirectory(int sector);
+    // The directory whose header is in
+    // "sector", read in unless cached
+    void ForgetDirectory(int sector);   // Drop it from the cache
+    void FlushDirCache();       // Drop every directory
+
+    // Open-file table: the in-core header of every file that is open,
+    // by header sector, so that opening a file that is already open
+    // shares its header instead of reading another copy.
+    HashTable<int, FileHeader*>* headerTable;
+
+    void ForgetHeader(int sector);  // Take a removed file's header out
+    // of the table
+    void ForgetHeaders();       // Empty the table at shutdown
 
     OpenFile* freeMapFile;       // Bit map of free disk blocks,
     // represented as a file
+    PersistentBitmap* freeMap;   // The same, kept in memory while
+    // Nachos is running; changes are
+    // written through to freeMapFile
     OpenFile* directoryFile;     // "Root" directory -- list of
     // file names, represented as a file
 
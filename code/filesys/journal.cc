@@ -0,0 +1,508 @@
+// journal.cc
+//  Routines to manage the metadata journal: grouping file system
+//  operations into transactions, writing them to the log, and
+//  replaying the log when the disk is mounted.
+//
+//  The superblock is an array of ints: JournalMagic, first sector
+//  of the log region, sectors in it, and the sequence number the
+//  first record in the region must have to be replayed.
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "journal.h"
+#include "main.h"
+
+// Words at the start of a record descriptor, before the sector list:
+// magic, sequence, count, last, checksum.
+#define RecordHeaderWords   5
+
+//----------------------------------------------------------------------
+// Journal::Journal
+//  Initialize the in-core part of a journal; the journal is disabled
+//  until Format or Recover finds it a log region.
+//
+//  "sector" -- where the journal superblock is
+//----------------------------------------------------------------------
+
+Journal::Journal(int sector) {
+    superSector = sector;
+    start = size = limit = head = 0;
+    sequence = 1;
+    depth = numOps = numLogged = 0;
+    firstOp = 0;
+    current = new Bitmap(NumSectors);
+    live = new Bitmap(NumSectors);
+    committing = FALSE;
+    deferred = 0;
+    commitDue = FALSE;
+    enabled = FALSE;
+}
+
+Journal::~Journal() {
+    if (enabled) {
+        kernel->synchDisk->UseJournal(NULL);
+    }
+    delete current;
+    delete live;
+}
+
+//----------------------------------------------------------------------
+// Journal::Format
+//  Set up an empty log in sectors "start" through "start + size - 1",
+//  which the caller has reserved in the free map, and write the
+//  superblock.  Operations are journaled from now on.
+//
+//  The disk may have been formatted before, with records of the old
+//  file system still in the region, numbered from 1 like the new
+//  ones; so the first sector is cleared, which ends the log there.
+//
+//  If "logSize" is 0, the disk is too small for a journal: the
+//  superblock is cleared instead, and the journal stays disabled.
+//----------------------------------------------------------------------
+
+void
+Journal::Format(int logStart, int logSize) {
+    char* buf = new char[SectorSize];
+
+    memset(buf, 0, SectorSize);
+    if (logSize == 0) {
+        kernel->synchDisk->WriteThrough(superSector, 1, buf);
+        delete [] buf;
+        return;
+    }
+
+    ASSERT(logSize >= MinJournalSize);
+    start = head = logStart;
+    size = logSize;
+    limit = Limit();
+    sequence = 1;
+    enabled = TRUE;
+    kernel->synchDisk->UseJournal(this);
+
+    kernel->synchDisk->WriteThrough(start, 1, buf);
+    delete [] buf;
+    WriteSuper();
+}
+
+//----------------------------------------------------------------------
+// Journal::Recover
+//  Read the superblock, and redo every complete commit found in the
+//  log: the records must follow each other from the start of the
+//  region with consecutive sequence numbers, starting with the one
+//  in the superblock, and have the right checksums.  The first record
+//  that does not ends the log; the records read since the last
+//  complete commit are thrown away.
+//
+//  The replayed sectors are then written home, and the log emptied.
+//  Return FALSE if the disk has no journal.
+//----------------------------------------------------------------------
+
+bool
+Journal::Recover() {
+    char* buf = new char[SectorSize];
+    int* words = (int*) buf;
+
+    kernel->synchDisk->ReadSector(superSector, buf);
+    if (words[0] != JournalMagic) {
+        delete [] buf;
+        return FALSE;           // too small a disk to journal
+    }
+
+    start = words[1];
+    size = words[2];
+    sequence = words[3];
+    ASSERT(start > superSector && size >= MinJournalSize
+           && start + size <= NumSectors);
+    limit = Limit();
+
+    int per = PerRecord();
+    int* sectors = new int[MaxLogged];
+    char* data = new char[MaxLogged * SectorSize];
+    int pending = 0;            // sectors read since the last commit
+    int numReplayed = 0;
+    int pos = start;
+
+    while (pos < start + size) {
+        kernel->synchDisk->ReadSector(pos, buf);
+        int count = words[2];
+
+        if (words[0] != RecordMagic || words[1] != sequence
+                || count <= 0 || count > per || pending + count > MaxLogged
+                || pos + 1 + count > start + size) {
+            break;              // the end of the log
+        }
+
+        bool valid = TRUE;
+        int* homes = &words[RecordHeaderWords];
+
+        kernel->synchDisk->FetchSectors(pos + 1, count);
+        for (int i = 0; i < count; i++) {
+            valid = valid && homes[i] >= 0 && homes[i] < NumSectors;
+            kernel->synchDisk->ReadSector(pos + 1 + i,
+                                          &data[(pending + i) * SectorSize]);
+        }
+
+        if (!valid || Checksum(sequence, homes, count, &data[pending * SectorSize])
+                != (unsigned) words[4]) {
+            break;              // torn write
+        }
+
+        bcopy(homes, &sectors[pending], count * sizeof(int));
+        pending += count;
+        sequence++;
+        pos += 1 + count;
+
+        if (words[3]) {         // the commit is all there: redo it
+            for (int i = 0; i < pending; i++) {
+                kernel->synchDisk->WriteSector(sectors[i], &data[i * SectorSize]);
+            }
+            numReplayed += pending;
+            pending = 0;
+        }
+    }
+
+    DEBUG(dbgFile, "Journal replayed " << numReplayed << " sectors, "
+          << pending << " sectors of an incomplete commit dropped");
+
+    delete [] buf;
+    delete [] sectors;
+    delete [] data;
+
+    enabled = TRUE;
+    kernel->synchDisk->UseJournal(this);
+    Checkpoint();               // write them home, start a fresh log
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Begin
+//  Start a file system operation; the sectors it modifies are held
+//  in the cache until the transaction is committed.  Operations may
+//  nest (a directory update extends the directory file), and only
+//  the outermost one counts.
+//
+//  A transaction that might not have room for the operation is
+//  committed first.
+//----------------------------------------------------------------------
+
+void
+Journal::Begin() {
+    if (!enabled) {
+        return;
+    }
+
+    if (depth == 0 && Full()) {
+        CommitSoon();
+    }
+    if (depth == 0 && numOps == 0) {
+        firstOp = kernel->stats->totalTicks;
+    }
+    depth++;
+}
+
+//----------------------------------------------------------------------
+// Journal::End
+//  Finish a file system operation.  When enough operations have
+//  piled up in the running transaction, commit them as a group.
+//
+//  A long operation ends and begins again between two of its steps;
+//  the transaction may be committed in between.
+//----------------------------------------------------------------------
+
+void
+Journal::End() {
+    if (!enabled) {
+        return;
+    }
+
+    ASSERT(depth > 0);
+    depth--;
+    if (depth == 0) {
+        numOps++;
+        if (commitDue || numOps >= GroupCommitOps || Full()
+                || kernel->stats->totalTicks - firstOp >= GroupCommitTicks) {
+            CommitSoon();
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// Journal::MaybeCommit
+//  Called between the sectors of a file write, which are logged
+//  outside any operation if an older copy is in the log: commit the
+//  transaction if it is filling up, as Begin would.
+//----------------------------------------------------------------------
+
+void
+Journal::MaybeCommit() {
+    if (enabled && depth == 0 && Full()) {
+        CommitSoon();
+    }
+}
+
+//----------------------------------------------------------------------
+// Journal::DeferCommit, Journal::AllowCommit
+//  Bracket a file write that allocates blocks: the operation that
+//  allocates them ends before the data is written into them, and a
+//  commit right then would record blocks still holding whatever was
+//  on the disk before.  A commit that falls due in between is made
+//  by AllowCommit instead.
+//----------------------------------------------------------------------
+
+void
+Journal::DeferCommit() {
+    deferred++;
+}
+
+void
+Journal::AllowCommit() {
+    ASSERT(deferred > 0);
+    deferred--;
+    if (commitDue) {
+        CommitSoon();
+    }
+}
+
+//----------------------------------------------------------------------
+// Journal::CommitSoon
+//  Commit the running transaction now, or, if an operation is in
+//  progress or commits are deferred, as soon as neither is the case.
+//----------------------------------------------------------------------
+
+void
+Journal::CommitSoon() {
+    if (deferred > 0 || depth > 0) {
+        commitDue = TRUE;
+    } else {
+        Commit();
+    }
+}
+
+//----------------------------------------------------------------------
+// Journal::Full
+//  Return TRUE if the running transaction might not have room for
+//  another MaxStepSectors sectors.
+//----------------------------------------------------------------------
+
+bool
+Journal::Full() {
+    return numLogged + MaxStepSectors > limit;
+}
+
+//----------------------------------------------------------------------
+// Journal::Log
+//  Called by SynchDisk, with its lock held, each time a cached sector
+//  is modified.  Return TRUE if the sector must be held in the cache
+//  for the running transaction: it is modified by an operation, or
+//  an older copy of it is in the log.
+//
+//  Operations are split into steps small enough that a transaction
+//  never outgrows what one commit can log.
+//
+//  "sector" -- the sector just modified
+//----------------------------------------------------------------------
+
+bool
+Journal::Log(int sector) {
+    if (current->Test(sector)) {
+        return TRUE;            // held already
+    }
+
+    if (depth == 0 && !live->Test(sector)) {
+        return FALSE;
+    }
+
+    ASSERT(numLogged < limit);
+
+    current->Mark(sector);
+    logged[numLogged++] = sector;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Commit
+//  Write the running transaction to the log, as one multi-sector
+//  transfer, and then let the cache write its sectors home.
+//
+//  The file data modified so far is flushed first, so that after a
+//  crash the blocks a replayed header points to hold what was written
+//  to them, not whatever was on the disk before.
+//
+//  Sectors modified while the log is being written go into the next
+//  transaction.  If the log region has no room left, it is emptied
+//  first.
+//----------------------------------------------------------------------
+
+void
+Journal::Commit() {
+    if (!enabled || committing || numLogged == 0) {
+        return;
+    }
+    committing = TRUE;
+    commitDue = FALSE;
+    kernel->synchDisk->Flush();     // pinned sectors stay behind
+
+    int sectors[MaxLogged];
+    int count = numLogged;
+    int per = PerRecord();
+    int numRecords = divRoundUp(count, per);
+    int needed = count + numRecords;
+
+    bcopy(logged, sectors, count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        current->Clear(sectors[i]);
+        live->Mark(sectors[i]);     // further changes are logged again
+    }
+    numLogged = 0;
+    numOps = 0;
+
+    ASSERT(needed <= size);     // see Log
+    if (head + needed > start + size) {
+        Reclaim(sectors, count);
+    }
+
+    DEBUG(dbgFile, "Journal commit of " << count << " sectors at " << head);
+
+    char* buf = new char[needed * SectorSize];
+    int pos = 0;
+
+    for (int r = 0; r < numRecords; r++) {
+        int first = r * per;
+        int n = min(per, count - first);
+        int* words = (int*) &buf[pos * SectorSize];
+        char* data = &buf[(pos + 1) * SectorSize];
+
+        memset(words, 0, SectorSize);
+        for (int i = 0; i < n; i++) {
+            kernel->synchDisk->ReadSector(sectors[first + i],
+                                          &data[i * SectorSize]);
+        }
+        words[0] = RecordMagic;
+        words[1] = sequence + r;
+        words[2] = n;
+        words[3] = (r == numRecords - 1);
+        words[4] = Checksum(sequence + r, &sectors[first], n, data);
+        bcopy(&sectors[first], &words[RecordHeaderWords], n * sizeof(int));
+        pos += 1 + n;
+    }
+
+    kernel->synchDisk->WriteThrough(head, needed, buf);
+    delete [] buf;
+
+    head += needed;
+    sequence += numRecords;
+    kernel->stats->numJournalCommits++;
+    kernel->stats->numJournalSectors += needed;
+
+    for (int i = 0; i < count; i++) {
+        if (!current->Test(sectors[i])) {   // not modified again since
+            kernel->synchDisk->Unpin(sectors[i]);
+        }
+    }
+    committing = FALSE;
+}
+
+//----------------------------------------------------------------------
+// Journal::Checkpoint
+//  Commit the running transaction, write every sector in the log
+//  home, and empty the log.  Called when the file system is
+//  unmounted, so the next mount has nothing to replay.
+//----------------------------------------------------------------------
+
+void
+Journal::Checkpoint() {
+    if (!enabled) {
+        return;
+    }
+
+    Commit();
+    Reclaim(NULL, 0);
+}
+
+//----------------------------------------------------------------------
+// Journal::Reclaim
+//  Empty the log region: flush the cache, so that every sector logged
+//  so far is home (the sectors held for the log stay in the cache),
+//  and record in the superblock that the records before "sequence"
+//  are not to be replayed.
+//
+//  "keep", "count" -- sectors about to be logged again, which stay
+//      in the set of sectors with a copy in the log
+//----------------------------------------------------------------------
+
+void
+Journal::Reclaim(int* keep, int count) {
+    kernel->synchDisk->Flush();
+
+    delete live;
+    live = new Bitmap(NumSectors);
+    for (int i = 0; i < count; i++) {
+        live->Mark(keep[i]);
+    }
+
+    head = start;
+    WriteSuper();
+}
+
+//----------------------------------------------------------------------
+// Journal::WriteSuper
+//  Write the superblock straight to disk.
+//----------------------------------------------------------------------
+
+void
+Journal::WriteSuper() {
+    char* buf = new char[SectorSize];
+    int* words = (int*) buf;
+
+    memset(buf, 0, SectorSize);
+    words[0] = JournalMagic;
+    words[1] = start;
+    words[2] = size;
+    words[3] = sequence;
+    kernel->synchDisk->WriteThrough(superSector, 1, buf);
+    delete [] buf;
+}
+
+//----------------------------------------------------------------------
+// Journal::PerRecord
+//  Return how many sectors one record descriptor can list.
+//----------------------------------------------------------------------
+
+int
+Journal::PerRecord() {
+    return SectorSize / sizeof(int) - RecordHeaderWords;
+}
+
+//----------------------------------------------------------------------
+// Journal::Limit
+//  Return how many sectors one commit can log: at most MaxLogged, and
+//  few enough that they fit in the region with their descriptors.
+//----------------------------------------------------------------------
+
+int
+Journal::Limit() {
+    return min(MaxLogged, size - divRoundUp(size, PerRecord() + 1));
+}
+
+//----------------------------------------------------------------------
+// Journal::Checksum
+//  Return a checksum (FNV-1a) of a record: its sequence number, the
+//  home sectors it lists, and their contents.
+//----------------------------------------------------------------------
+
+unsigned
+Journal::Checksum(int seq, int* sectors, int count, char* data) {
+    unsigned h = 2166136261u ^ (unsigned) seq;
+
+    for (int i = 0; i < count; i++) {
+        h = (h ^ (unsigned) sectors[i]) * 16777619u;
+    }
+    for (int i = 0; i < count * SectorSize; i++) {
+        h = (h ^ (unsigned char) data[i]) * 16777619u;
+    }
+    return h;
+}
@@ -0,0 +1,163 @@
+// journal.h
+//  Data structures for the file system metadata journal.
+//
+//  The journal is a write-ahead log kept in a region of the disk.
+//  Each file system operation that modifies metadata (file headers,
+//  indirect blocks, directories, the free map) is bracketed by
+//  Begin and End; the sectors it modifies are held in the disk cache
+//  until they have been written to the log, and only then may they
+//  go to their home locations.  After a crash, replaying the log on
+//  the next mount redoes every operation that reached it, so the
+//  disk never shows half of an operation (or of a step of a long
+//  one, see below).
+//
+// Copyright (c) 1992-1993 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "bitmap.h"
+#include "synchdisk.h"
+
+// Identifies the journal superblock, and the descriptor of a record.
+const int JournalMagic = 0x4a524e4c;
+const int RecordMagic = 0x52454352;
+
+// Most distinct sectors a transaction may hold in the cache before it
+// is committed.  Held sectors can't be evicted, so this stays well
+// below the size of the cache.
+const int MaxLogged = NumCacheEntries / 2;
+
+// Most sectors one operation, or one step of a long operation, may
+// modify.  A transaction is committed before the next operation or
+// step begins if it might not have room for that many more.
+const int MaxStepSectors = MaxLogged / 2;
+
+// Sectors in the log region: 1/16 of the disk, within these bounds.
+// A disk too small to spare the smallest region is not journaled.
+const int MinJournalSize = MaxLogged + 2;
+const int MaxJournalSize = 64;
+
+// A group commit is made when the running transaction has this many
+// operations, or its first operation is this many ticks old, unless
+// it fills up first.
+const int GroupCommitOps = 64;
+const int GroupCommitTicks = 100000;
+
+// The following class defines the metadata journal.
+//
+// On disk, the journal is a superblock in a well-known sector, giving
+// where the log region is and the sequence number of the first record
+// in it, followed (somewhere) by the log region.  The log is a series
+// of records, each a descriptor sector -- RecordMagic, sequence number,
+// number of sectors, "last" flag, checksum, then the home sector
+// numbers -- followed by the logged contents of those sectors.  The
+// records of one commit are written with a single multi-sector
+// transfer; the last one has the "last" flag set, and a commit counts
+// only if all of its records are there with the right checksums.
+//
+// Operations are grouped: the running transaction collects the
+// sectors modified by several operations, and is committed when
+// GroupCommitOps operations have ended, when an operation ends
+// GroupCommitTicks after the first one began, when it may not have
+// room for another MaxStepSectors, or at a sync point (unmount).  A
+// crash can lose the operations of a group that was not committed
+// yet, but never leaves part of one.
+//
+// A transaction is only committed between operations, and must fit
+// in the log in one piece.  Operations that could modify more than
+// MaxStepSectors sectors -- a large write, or removing a big file or
+// a directory tree -- are split into steps that each leave the file
+// system consistent, and end and begin again between two steps, so
+// that a commit can come in between.  A crash in the middle of such
+// an operation leaves the steps that were committed: part of the
+// data of a write, or some of the blocks of a removed file not freed
+// yet.
+//
+// A commit flushes the cache before writing the log, so that file data
+// reaches the disk before the metadata that points to it.  A write that
+// allocates blocks defers commits until its data is in the cache.
+//
+// Once committed, the sectors are released to the cache, which writes
+// them home in its own time.  When the log region is full, the cache
+// is flushed -- a checkpoint -- and the log starts over at the
+// beginning of the region with the next sequence number, recorded in
+// the superblock, so that the old records are no longer replayed.  A
+// sector that is still in the log since the last checkpoint is logged
+// again whenever it is modified, even outside an operation (a freed
+// directory block reused for file data, say), so that replaying an
+// old copy can never overwrite newer contents.
+//
+// A disk too small to spare MinJournalSize sectors for the journal
+// has no superblock; the journal is then disabled, and metadata is
+// written in place.  A disk formatted before the journal existed
+// has no disk superblock either, and is refused before the journal
+// is looked for (see Disk::Disk).
+
+class Journal {
+public:
+    Journal(int sector);        // Initialize a journal whose superblock
+    // is in "sector"; not usable until
+    // Format or Recover is called
+    ~Journal();
+
+    void Format(int start, int size);   // Set up an empty log in sectors
+    // "start" to "start + size - 1", or
+    // no journal if "size" is 0
+    bool Recover();             // Replay the log of an existing disk;
+    // FALSE if the disk has no journal
+
+    void Begin();               // Start a file system operation
+    void End();                 // Finish it
+    void Commit();              // Write the running transaction to
+    // the log
+    void MaybeCommit();         // Commit if the transaction is
+    // filling up and no operation is
+    // in progress
+    void DeferCommit();         // Hold off commits until AllowCommit
+    void AllowCommit();
+    void Checkpoint();          // Commit, write every logged sector
+    // home, and empty the log
+
+    bool Log(int sector);       // Called by SynchDisk when a cached
+    // sector is modified: TRUE if it
+    // must be held for the log
+
+    bool enabled;               // Is there a journal on this disk?
+
+private:
+    int superSector;            // Where the superblock is
+    int start;                  // First sector of the log region
+    int size;                   // Sectors in the log region
+    int limit;                  // Most sectors one commit can log
+    int sequence;               // Sequence number of the next record
+    int head;                   // Where the next record goes
+
+    int depth;                  // Nesting of Begin/End
+    int numOps;                 // Operations in the running transaction
+    int firstOp;                // When the first one began, in ticks
+    int numLogged;              // Sectors held by it
+    int logged[MaxLogged];      // Which ones
+    Bitmap* current;            // The same, as a set
+    Bitmap* live;               // Sectors with a copy in the log
+    bool committing;            // Is a commit being written?
+    int deferred;               // DeferCommit calls not yet matched
+    bool commitDue;             // Commit once they are?
+
+    int PerRecord();            // Sectors described by one descriptor
+    int Limit();                // Most sectors that fit in the region
+    unsigned Checksum(int seq, int* sectors, int count, char* data);
+    bool Full();                // Might the transaction not have
+    // room for another step?
+    void CommitSoon();          // Commit, or do so once no operation
+    // is in progress and commits are
+    // no longer deferred
+    void Reclaim(int* keep, int count); // Empty the log region
+    void WriteSuper();          // Write the superblock through to disk
+};
+
+#endif // JOURNAL_H
@@ -17,19 +17,27 @@
 #include "filehdr.h"
 #include "openfile.h"
 #include "synchdisk.h"
+#include "journal.h"
 
 //----------------------------------------------------------------------
 // OpenFile::OpenFile
-//  Open a Nachos file for reading and writing.  Bring the file header
-//  into memory while the file is open.
+//  Open a Nachos file for reading and writing.  The file header is
+//  the in-core one from the open-file table, shared by every open
+//  file on the same file, so that they all see the same length and
+//  blocks; the reference taken by FileSystem::AcquireHeader is ours
+//  until the file is closed.
 //
-//  "sector" -- the location on disk of the file header for this file
+//  "header" -- the in-core file header for this file
 //----------------------------------------------------------------------
 
-OpenFile::OpenFile(int sector) {
-    hdr = new FileHeader;
-    hdr->FetchFrom(sector);
+OpenFile::OpenFile(FileHeader* header) {
+    hdr = header;
+    hdrSector = header->sector;
     seekPosition = 0;
+    lastReadSector = -1;
+    readAheadWindow = 0;
+    readAheadEnd = 0;
+    writeEnd = -1;
 }
 
 //----------------------------------------------------------------------
@@ -38,7 +46,7 @@ OpenFile::OpenFile(int sector) {
 //----------------------------------------------------------------------
 
 OpenFile::~OpenFile() {
-    delete hdr;
+    kernel->fileSystem->ReleaseHeader(hdr);
 }
 
 //----------------------------------------------------------------------
@@ -89,16 +97,20 @@ OpenFile::Write(char* into, int numBytes) {
 //
 //  There is no guarantee the request starts or ends on an even disk sector
 //  boundary; however the disk only knows how to read/write a whole disk
-//  sector at a time.  Thus:
+//  sector at a time.  The sector cache hides this: each sector touched
+//  by the request is copied straight between the cache and the
+//  caller's buffer, so no sector-sized buffer is needed here.
 //
-//  For ReadAt:
-//     We read in all of the full or partial sectors that are part of the
-//     request, but we only copy the part we are interested in.
-//  For WriteAt:
-//     We must first read in any sectors that will be partially written,
-//     so that we don't overwrite the unmodified portion.  We then copy
-//     in the data that will be modified, and write back all the full
-//     or partial sectors that are part of the request.
+//  For WriteAt, only a sector that is partially written has to be
+//  read in first, so that we don't overwrite the unmodified portion;
+//  a sector that is completely overwritten never is.
+//
+//  Sectors of the file that have never been written have no disk
+//  block yet: ReadAt returns zeros for them, and WriteAt asks the
+//  file system to allocate them as it gets to them, AllocateStep
+//  sectors at a time, so a large write is a series of small journal
+//  operations.  A write past the end of the file extends it; if the
+//  disk fills up, the write stops short.
 //
 //  "into" -- the buffer to contain the data to be read from disk
 //  "from" -- the buffer containing the data to be written to disk
@@ -110,8 +122,7 @@ OpenFile::Write(char* into, int numBytes) {
 int
 OpenFile::ReadAt(char* into, int numBytes, int position) {
     int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
-    char* buf;
+    int firstSector, lastSector, done;
 
     if ((numBytes <= 0) || (position >= fileLength)) {
         return 0;    // check request
@@ -125,72 +136,248 @@ OpenFile::ReadAt(char* into, int numBytes, int position) {
 
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
-    numSectors = 1 + lastSector - firstSector;
 
-    // read in all the full and partial sectors that we need
-    buf = new char[numSectors * SectorSize];
+    // start reading in all the sectors at once, so that the disk can
+    // transfer each run of adjacent ones in one go
+    if (lastSector > firstSector) {
+        int sector, run;
+
+        for (int i = firstSector; i <= lastSector; i += run) {
+            run = DiskRun(i, lastSector, &sector);
+
+            if (sector != -1) {
+                kernel->synchDisk->FetchSectors(sector, run);
+            }
+        }
+    }
+
+    // copy the part of each sector we want
+    for (done = 0; done < numBytes;) {
+        int offset = (position + done) % SectorSize;
+        int chunk = min(SectorSize - offset, numBytes - done);
+
+        int sector = hdr->ByteToSector(position + done);
 
-    for (i = firstSector; i <= lastSector; i++) {
-        kernel->synchDisk->ReadSector(hdr->ByteToSector(i * SectorSize),
-                                      &buf[(i - firstSector) * SectorSize]);
+        if (sector == -1) {
+            memset(&into[done], 0, chunk);  // a hole
+        } else {
+            kernel->synchDisk->ReadPartial(sector, &into[done], offset, chunk);
+        }
+
+        done += chunk;
     }
 
-    // copy the part we want
-    bcopy(&buf[position - (firstSector * SectorSize)], into, numBytes);
-    delete [] buf;
+    ReadAhead(firstSector, lastSector);
     return numBytes;
 }
 
 int
 OpenFile::WriteAt(char* from, int numBytes, int position) {
     int fileLength = hdr->FileLength();
-    int i, firstSector, lastSector, numSectors;
-    bool firstAligned, lastAligned;
-    char* buf;
+    int maxLength = hdr->MaxLength();
+    int firstSector, lastSector, done;
+    int stepEnd = -1;           // last sector given blocks so far
+    bool deferred = FALSE;      // are they waiting for their data?
+    bool hdrChanged = FALSE;
 
-    if ((numBytes <= 0) || (position >= fileLength)) {
+    if ((numBytes <= 0) || (position < 0) || (position >= maxLength)) {
         return 0;    // check request
     }
 
-    if ((position + numBytes) > fileLength) {
-        numBytes = fileLength - position;
+    if ((position + numBytes) > maxLength) {
+        numBytes = maxLength - position;
     }
 
     DEBUG(dbgFile, "Writing " << numBytes << " bytes at " << position << " from file of length " << fileLength);
 
     firstSector = divRoundDown(position, SectorSize);
     lastSector = divRoundDown(position + numBytes - 1, SectorSize);
-    numSectors = 1 + lastSector - firstSector;
 
-    buf = new char[numSectors * SectorSize];
+    // only the first and last sector can be partially written; if
+    // they are new, the part we don't write must read back as zeros
+    bool zeroFirst = (hdr->ByteToSector(firstSector * SectorSize) == -1)
+                     && (position % SectorSize != 0
+                         || position + numBytes < (firstSector + 1) * SectorSize);
+    bool zeroLast = (lastSector != firstSector)
+                    && (hdr->ByteToSector(lastSector * SectorSize) == -1)
+                    && ((position + numBytes) % SectorSize != 0);
+
+    // copy in the bytes we want to change, a sector at a time
+    for (done = 0; done < numBytes;) {
+        int fileSector = (position + done) / SectorSize;
+        int offset = (position + done) % SectorSize;
+        int chunk = min(SectorSize - offset, numBytes - done);
+        int sector = hdr->ByteToSector(position + done);
+
+        if (deferred && fileSector > stepEnd) {     // the new blocks are filled
+            kernel->fileSystem->journal->AllowCommit();
+            deferred = FALSE;
+        }
+
+        if (kernel->fileSystem != NULL) {       // NULL while formatting
+            kernel->fileSystem->journal->MaybeCommit();
+        }
+
+        if (sector == -1) {
+            // give blocks to the next few sectors (this also writes the
+            // header back); the journal must not commit them before
+            // the data is in them
+            stepEnd = min(fileSector + AllocateStep - 1, lastSector);
+            kernel->fileSystem->journal->DeferCommit();
+            deferred = TRUE;
+
+            if (!kernel->fileSystem->AllocateBlocks(hdr, hdrSector, fileSector,
+                                                    stepEnd, lastSector)) {
+                // out of space: write as much as got allocated
+                int i = fileSector;
+
+                while (i <= stepEnd && hdr->ByteToSector(i * SectorSize) != -1) {
+                    i++;
+                }
+
+                numBytes = max(min(numBytes, i * SectorSize - position), 0);
+                if (done >= numBytes) {
+                    break;
+                }
+            }
+
+            sector = hdr->ByteToSector(position + done);
+        }
+
+        if ((fileSector == firstSector && zeroFirst)
+                || (fileSector == lastSector && zeroLast)) {
+            kernel->synchDisk->ZeroSector(sector);
+        }
+
+        kernel->synchDisk->WritePartial(sector, &from[done], offset, chunk);
+        done += chunk;
+    }
 
-    // Mp4 mod tag
-    memset(buf, 0, sizeof(char) * numSectors * SectorSize); // dummy operation to keep valgrind happy
+    if (numBytes > 0 && position + numBytes > fileLength) {
+        hdr->numBytes = position + numBytes;
+        hdrChanged = TRUE;
+    }
 
-    firstAligned = (position == (firstSector * SectorSize));
-    lastAligned = ((position + numBytes) == ((lastSector + 1) * SectorSize));
+    if (hdrChanged) {
+        kernel->fileSystem->journal->Begin();
+        hdr->WriteBack(hdrSector);
+        kernel->fileSystem->journal->End();
+    }
 
-    // read in first and last sector, if they are to be partially modified
-    if (!firstAligned) {
-        ReadAt(buf, SectorSize, firstSector * SectorSize);
+    if (deferred) {
+        kernel->fileSystem->journal->AllowCommit();
     }
 
-    if (!lastAligned && ((firstSector != lastSector) || firstAligned)) {
-        ReadAt(&buf[(lastSector - firstSector) * SectorSize],
-               SectorSize, lastSector * SectorSize);
+    WriteBehind(position, numBytes);
+    return numBytes;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::ReadAhead
+//  Called after file sectors "firstSector" through "lastSector" have
+//  been read.  A read that starts in the sector where the previous
+//  one ended, or in the sector after it, is taken as part of a
+//  sequential scan: every time the scan moves on to a new sector the
+//  read-ahead window doubles, up to MaxReadAhead, and the sectors in
+//  the window that were not prefetched yet are handed to the disk,
+//  which reads them in while the reader gets on with its work.
+//  Any other read closes the window.
+//
+//  "firstSector", "lastSector" -- the file sectors just read
+//----------------------------------------------------------------------
+
+void
+OpenFile::ReadAhead(int firstSector, int lastSector) {
+    if (firstSector == lastReadSector || firstSector == lastReadSector + 1) {
+        if (lastSector > lastReadSector) {
+            readAheadWindow = (readAheadWindow == 0) ? 1 : readAheadWindow * 2;
+
+            if (readAheadWindow > MaxReadAhead) {
+                readAheadWindow = MaxReadAhead;
+            }
+        }
+    } else {
+        readAheadWindow = 0;
+        readAheadEnd = 0;
     }
 
-    // copy in the bytes we want to change
-    bcopy(from, &buf[position - (firstSector * SectorSize)], numBytes);
+    lastReadSector = lastSector;
 
-    // write modified sectors back
-    for (i = firstSector; i <= lastSector; i++) {
-        kernel->synchDisk->WriteSector(hdr->ByteToSector(i * SectorSize),
-                                       &buf[(i - firstSector) * SectorSize]);
+    if (readAheadWindow == 0) {
+        return;
     }
 
-    delete [] buf;
-    return numBytes;
+    int fileLastSector = divRoundDown(hdr->FileLength() - 1, SectorSize);
+    int from = max(readAheadEnd, lastSector + 1);
+    int to = min(lastSector + readAheadWindow, fileLastSector);
+
+    for (int i = from; i <= to; i++) {
+        int sector = hdr->ByteToSector(i * SectorSize);
+
+        if (sector != -1) {
+            kernel->synchDisk->Prefetch(sector);
+        }
+    }
+
+    if (to >= from) {
+        readAheadEnd = to + 1;
+    }
+}
+
+//----------------------------------------------------------------------
+// OpenFile::WriteBehind
+//  Called after "numBytes" bytes have been written at "position".  A
+//  write that starts where the previous one ended is taken as part
+//  of a sequential stream, and the sectors it moved past are done
+//  with: their write-backs are started right away, without waiting,
+//  a run of adjacent disk sectors at a time, so the disk works on
+//  them while the writer goes on.  Otherwise
+//  they would stay dirty in the cache until evicted, and the writer
+//  would have to wait for them then.
+//
+//  "position", "numBytes" -- the part of the file just written
+//----------------------------------------------------------------------
+
+void
+OpenFile::WriteBehind(int position, int numBytes) {
+    if (position == writeEnd) {
+        int end = divRoundDown(position + numBytes, SectorSize);
+        int sector, run;
+
+        for (int i = divRoundDown(position, SectorSize); i < end; i += run) {
+            run = DiskRun(i, end - 1, &sector);
+
+            if (sector != -1) {
+                kernel->synchDisk->WriteBackSectors(sector, run);
+            }
+        }
+    }
+
+    writeEnd = position + numBytes;
+}
+
+//----------------------------------------------------------------------
+// OpenFile::DiskRun
+//  Return how many file sectors, from "fileSector" on and up to
+//  "lastSector", are stored in consecutive disk sectors (or are all
+//  holes), at most MaxTransfer of them.  Set "diskSector" to the disk
+//  sector of the first one, -1 for a hole.
+//----------------------------------------------------------------------
+
+int
+OpenFile::DiskRun(int fileSector, int lastSector, int* diskSector) {
+    int run = 1;
+
+    *diskSector = hdr->ByteToSector(fileSector * SectorSize);
+    while (run < MaxTransfer && fileSector + run <= lastSector) {
+        int next = hdr->ByteToSector((fileSector + run) * SectorSize);
+
+        if ((*diskSector == -1) ? (next != -1) : (next != *diskSector + run)) {
+            break;
+        }
+        run++;
+    }
+    return run;
 }
 
 //----------------------------------------------------------------------
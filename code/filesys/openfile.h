@@ -70,11 +70,15 @@ private:
 #else // FILESYS
 class FileHeader;
 
+// Most sectors an open file reads ahead of a sequential reader.
+const int MaxReadAhead = 8;
+
 class OpenFile {
 public:
-    OpenFile(int sector);       // Open a file whose header is located
-    // at "sector" on the disk
-    ~OpenFile();            // Close the file
+    OpenFile(FileHeader* header);   // Open a file, given its header
+    // from the open-file table (see
+    // FileSystem::AcquireHeader)
+    ~OpenFile();            // Close the file, releasing the header
 
     void Seek(int position);        // Set the position from which to
     // start reading/writing -- UNIX lseek
@@ -89,6 +93,8 @@ public:
     // Read/write bytes from the file,
     // bypassing the implicit position.
     int WriteAt(char* from, int numBytes, int position);
+    // Writing past the end of the file
+    // makes it longer
 
     int Length();           // Return the number of bytes in the
     // file (this interface is simpler
@@ -96,8 +102,27 @@ public:
     // end of file, tell, lseek back
 
 private:
-    FileHeader* hdr;            // Header for this file
+    FileHeader* hdr;            // Header for this file, shared with
+    // every other open file on it
+    int hdrSector;              // Where the header lives on disk
     int seekPosition;           // Current position within the file
+
+    int lastReadSector;         // Last file sector read, -1 if none
+    int readAheadWindow;        // Sectors to stay ahead of the reader
+    int readAheadEnd;           // First file sector not prefetched yet
+
+    int writeEnd;               // Byte after the last write, -1
+    // if none
+
+    void ReadAhead(int firstSector, int lastSector);
+    // Prefetch the sectors following a
+    // read, if reads look sequential
+    void WriteBehind(int position, int numBytes);
+    // Start writing back the sectors a
+    // sequential writer has finished
+    int DiskRun(int fileSector, int lastSector, int* diskSector);
+    // Length of a run of file sectors
+    // in adjacent disk sectors
 };
 
 #endif // FILESYS
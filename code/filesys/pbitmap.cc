@@ -16,10 +16,18 @@
 //
 //  "numItems" is the number of bits in the bitmap.
 //
-//      This constructor does not initialize the bitmap from a disk file
+//      This constructor does not initialize the bitmap from a disk file,
+//      so all of it counts as changed, and the first WriteBack writes
+//      the whole bitmap.
 //----------------------------------------------------------------------
 
 PersistentBitmap::PersistentBitmap(int numItems): Bitmap(numItems) {
+    int numSectors = divRoundUp(numWords * sizeof(unsigned), SectorSize);
+
+    dirty = new Bitmap(numSectors);
+    for (int i = 0; i < numSectors; i++) {
+        dirty->Mark(i);
+    }
 }
 
 //----------------------------------------------------------------------
@@ -38,7 +46,9 @@ PersistentBitmap::PersistentBitmap(OpenFile* file, int numItems): Bitmap(numItem
     // map has already been initialized by the BitMap constructor,
     // but we will just overwrite that with the contents of the
     // map found in the file
+    dirty = new Bitmap(divRoundUp(numWords * sizeof(unsigned), SectorSize));
     file->ReadAt((char*)map, numWords * sizeof(unsigned), 0);
+    Rebuild();
 }
 
 //----------------------------------------------------------------------
@@ -47,6 +57,7 @@ PersistentBitmap::PersistentBitmap(OpenFile* file, int numItems): Bitmap(numItem
 //----------------------------------------------------------------------
 
 PersistentBitmap::~PersistentBitmap() {
+    delete dirty;
 }
 
 //----------------------------------------------------------------------
@@ -59,16 +70,75 @@ PersistentBitmap::~PersistentBitmap() {
 void
 PersistentBitmap::FetchFrom(OpenFile* file) {
     file->ReadAt((char*)map, numWords * sizeof(unsigned), 0);
+    Rebuild();
+
+    int numSectors = divRoundUp(numWords * sizeof(unsigned), SectorSize);
+    for (int i = 0; i < numSectors; i++) {
+        dirty->Clear(i);
+    }
 }
 
 //----------------------------------------------------------------------
 // PersistentBitmap::WriteBack
-//  Store the contents of a persistent bitmap to a Nachos file.
+//  Store the contents of a persistent bitmap to a Nachos file.  Only
+//  the sectors of the file whose bits changed are written, each run
+//  of adjacent ones with a single write.
+//
+//  With "maxSectors", stop once that many have been written, so that
+//  a bitmap with many changes can be written back a piece at a time;
+//  return TRUE if none is left.
 //
 //  "file" is the place to write the bitmap to
+//  "maxSectors" -- the most sectors to write
 //----------------------------------------------------------------------
 
 void
 PersistentBitmap::WriteBack(OpenFile* file) {
-    file->WriteAt((char*)map, numWords * sizeof(unsigned), 0);
+    (void) WriteBack(file, divRoundUp(numWords * sizeof(unsigned), SectorSize));
+}
+
+bool
+PersistentBitmap::WriteBack(OpenFile* file, int maxSectors) {
+    int numBytes = numWords * sizeof(unsigned);
+    int numSectors = divRoundUp(numBytes, SectorSize);
+
+    for (int first = 0; first < numSectors; first++) {
+        if (!dirty->Test(first)) {
+            continue;
+        }
+
+        if (maxSectors == 0) {
+            return FALSE;
+        }
+
+        int last = first;
+        while (last + 1 < numSectors && last + 1 < first + maxSectors
+                && dirty->Test(last + 1)) {
+            last++;
+        }
+        maxSectors -= last - first + 1;
+
+        for (int i = first; i <= last; i++) {
+            dirty->Clear(i);
+        }
+
+        int offset = first * SectorSize;
+        int length = min((last + 1) * SectorSize, numBytes) - offset;
+        file->WriteAt((char*)map + offset, length, offset);
+        first = last;
+    }
+
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// PersistentBitmap::Changed
+//  Called by Bitmap whenever a bit of map word "word" is set or
+//  cleared: the sector of the file holding that word must be written
+//  back.
+//----------------------------------------------------------------------
+
+void
+PersistentBitmap::Changed(int word) {
+    dirty->Mark(word * sizeof(unsigned) / SectorSize);
 }
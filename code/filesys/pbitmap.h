@@ -16,10 +16,16 @@
 #include "copyright.h"
 #include "bitmap.h"
 #include "openfile.h"
+#include "disk.h"
 
 // The following class defines a persistent bitmap.  It inherits all
 // the behavior of a bitmap (see bitmap.h), adding the ability to
 // be read from and stored to the disk.
+//
+// The bitmap remembers which sectors of its file hold bits that changed
+// since it was last fetched or written back, and WriteBack only writes
+// those, so that a bitmap kept in memory for the life of the file
+// system costs a sector or two per update instead of the whole file.
 
 class PersistentBitmap : public Bitmap {
 public:
@@ -29,7 +35,18 @@ public:
     ~PersistentBitmap();            // deallocate bitmap
 
     void FetchFrom(OpenFile* file);     // read bitmap from the disk
-    void WriteBack(OpenFile* file);     // write bitmap contents to disk
+    void WriteBack(OpenFile* file);     // write changed parts of the
+    // bitmap to disk
+    bool WriteBack(OpenFile* file, int maxSectors);
+    // the same, but at most "maxSectors"
+    // sectors of them; TRUE if that
+    // was all
+
+private:
+    Bitmap* dirty;              // Sectors of the bitmap file with
+    // changes not written back yet
+
+    void Changed(int word);     // Note that map word "word" changed
 };
 
 #endif // PBITMAP_H
@@ -5,10 +5,24 @@
 //  the disk providing a synchronous interface (requests wait until
 //  the request completes).
 //
-//  Use a semaphore to synchronize the interrupt handlers with the
-//  pending requests.  And, because the physical disk can only
-//  handle one operation at a time, use a lock to enforce mutual
-//  exclusion.
+//  Recently used sectors are kept in a small write-back cache, managed
+//  with the CLOCK algorithm.  Only misses and write-backs of dirty
+//  sectors go to the physical disk.
+//
+//  The physical disk can only handle one operation at a time, so
+//  requests for it are queued.  A thread queues its request and
+//  sleeps on a semaphore, which the interrupt handler signals when
+//  the request completes; the handler then sends the next request
+//  to the disk, as chosen by the scheduling policy.  A lock protects
+//  the cache, but it is released while a thread waits for the disk,
+//  so other threads can use the cache and queue requests of their own.
+//  The slot a request reads into or writes from is marked busy until
+//  the request completes.  Since threads only give up the CPU at
+//  well-defined points, the interrupt handler can update the queue
+//  and the busy marks without taking the lock.
+//
+//  Sectors can also be prefetched into the cache.  A prefetch claims
+//  a cache slot right away, and queues the read with a low priority.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -16,21 +30,60 @@
 
 #include "copyright.h"
 #include "synchdisk.h"
+#include "journal.h"
+#include "main.h"
 
 
 //----------------------------------------------------------------------
 // SynchDisk::SynchDisk
 //  Initialize the synchronous interface to the physical disk, in turn
-//  initializing the physical disk.
-//
+//  initializing the physical disk.  The scheduling policy is the one
+//  named on the command line ("fcfs", "sstf", "scan" or "clook"), or
+//  C-LOOK by default.
 //----------------------------------------------------------------------
 
 SynchDisk::SynchDisk() {
-    static char synchDisk[20] = "synch disk";
     static char synchDiskLock[20] = "synch disk lock";
-    semaphore = new Semaphore(synchDisk, 0);
+    static const char* policyNames[] = { "FCFS", "SSTF", "SCAN", "C-LOOK" };
+
     lock = new Lock(synchDiskLock);
     disk = new Disk(this);
+
+    cache = new CacheEntry[NumCacheEntries];
+    for (int i = 0; i < NumCacheEntries; i++) {
+        cache[i].sector = -1;
+        cache[i].dirty = FALSE;
+        cache[i].used = FALSE;
+        cache[i].io = NULL;
+        cache[i].pinned = FALSE;
+        cache[i].data = new char[SectorSize];
+    }
+    cacheIndex = new int[NumSectors];
+    for (int i = 0; i < NumSectors; i++) {
+        cacheIndex[i] = -1;
+    }
+    clockHand = 0;
+
+    policy = DiskCLOOK;
+    if (kernel->diskScheduler != NULL) {
+        if (strcmp(kernel->diskScheduler, "fcfs") == 0) {
+            policy = DiskFCFS;
+        } else if (strcmp(kernel->diskScheduler, "sstf") == 0) {
+            policy = DiskSSTF;
+        } else if (strcmp(kernel->diskScheduler, "scan") == 0) {
+            policy = DiskSCAN;
+        } else {
+            ASSERT(strcmp(kernel->diskScheduler, "clook") == 0);
+        }
+    }
+    kernel->stats->diskScheduler = policyNames[policy];
+
+    queue = new List<DiskRequest*>;
+    numCurrent = 0;
+    batching = FALSE;
+    sweepUp = TRUE;
+    numPrefetching = 0;
+    journal = NULL;
 }
 
 //----------------------------------------------------------------------
@@ -40,9 +93,16 @@ SynchDisk::SynchDisk() {
 //----------------------------------------------------------------------
 
 SynchDisk::~SynchDisk() {
+    Flush();                    // also waits for every request
+    ASSERT(numCurrent == 0 && queue->IsEmpty());
+    delete queue;
+    delete [] cacheIndex;
+    for (int i = 0; i < NumCacheEntries; i++) {
+        delete [] cache[i].data;
+    }
+    delete [] cache;
     delete disk;
     delete lock;
-    delete semaphore;
 }
 
 //----------------------------------------------------------------------
@@ -56,16 +116,14 @@ SynchDisk::~SynchDisk() {
 
 void
 SynchDisk::ReadSector(int sectorNumber, char* data) {
-    lock->Acquire();            // only one disk I/O at a time
-    disk->ReadRequest(sectorNumber, data);
-    semaphore->P();         // wait for interrupt
-    lock->Release();
+    ReadPartial(sectorNumber, data, 0, SectorSize);
 }
 
 //----------------------------------------------------------------------
 // SynchDisk::WriteSector
-//  Write the contents of a buffer into a disk sector.  Return only
-//  after the data has been written.
+//  Write the contents of a buffer into a disk sector.  The sector
+//  is only updated in the cache; it reaches the disk when it is
+//  evicted, or on the next Flush.
 //
 //  "sectorNumber" -- the disk sector to be written
 //  "data" -- the new contents of the disk sector
@@ -73,19 +131,889 @@ SynchDisk::ReadSector(int sectorNumber, char* data) {
 
 void
 SynchDisk::WriteSector(int sectorNumber, char* data) {
-    lock->Acquire();            // only one disk I/O at a time
-    disk->WriteRequest(sectorNumber, data);
-    semaphore->P();         // wait for interrupt
+    WritePartial(sectorNumber, data, 0, SectorSize);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadPartial
+//  Copy "numBytes" bytes, starting "offset" bytes into a disk sector,
+//  into a buffer.  Return only after the data has been read.
+//
+//  "sectorNumber" -- the disk sector to read
+//  "into" -- the buffer to hold the bytes
+//  "offset", "numBytes" -- the part of the sector wanted
+//----------------------------------------------------------------------
+
+void
+SynchDisk::ReadPartial(int sectorNumber, char* into, int offset, int numBytes) {
+    ASSERT(offset >= 0 && numBytes >= 0 && offset + numBytes <= SectorSize);
+
+    lock->Acquire();
+    int slot = FindSlot(sectorNumber, TRUE);
+    bcopy(&cache[slot].data[offset], into, numBytes);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WritePartial
+//  Overwrite "numBytes" bytes of a disk sector, starting "offset"
+//  bytes into it.  The rest of the sector is only read in from disk
+//  when the write does not cover all of it.
+//
+//  "sectorNumber" -- the disk sector to be written
+//  "from" -- the new contents of that part of the sector
+//  "offset", "numBytes" -- the part of the sector being written
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WritePartial(int sectorNumber, char* from, int offset, int numBytes) {
+    ASSERT(offset >= 0 && numBytes >= 0 && offset + numBytes <= SectorSize);
+
+    lock->Acquire();
+    int slot = FindSlot(sectorNumber, numBytes < SectorSize);
+    bcopy(from, &cache[slot].data[offset], numBytes);
+    Modified(slot);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ZeroSector
+//  Fill a disk sector with zeros.  Like WriteSector, this only
+//  updates the cache.
+//
+//  "sectorNumber" -- the disk sector to be cleared
+//----------------------------------------------------------------------
+
+void
+SynchDisk::ZeroSector(int sectorNumber) {
+    lock->Acquire();
+    int slot = FindSlot(sectorNumber, FALSE);
+    memset(cache[slot].data, 0, SectorSize);
+    Modified(slot);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Flush
+//  Write every modified sector in the cache back to disk.  The sectors
+//  stay cached (now clean).  Sectors pinned for the journal are left
+//  alone.
+//
+//  This is enough for the journal: the sectors are on the simulated
+//  disk, in order, whatever happens to Nachos afterwards.  Forcing them
+//  on to the host's storage is left to Sync, which is much slower.
+//
+//  All the write-backs are queued before any is sent, so the scheduling
+//  policy can put them in a good order, and write runs of adjacent
+//  sectors together.  We also wait for the reads in progress, so the
+//  disk is idle when we return.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Flush() {
+    lock->Acquire();
+    batching = TRUE;
+    for (int i = 0; i < NumCacheEntries; i++) {
+        if (cache[i].dirty && !cache[i].pinned && cache[i].io == NULL) {
+            StartIO(i, TRUE, FALSE);
+        }
+    }
+    batching = FALSE;
+    StartNext();
+    for (int i = 0; i < NumCacheEntries; i++) {
+        while (cache[i].io != NULL || (cache[i].dirty && !cache[i].pinned)) {
+            if (cache[i].io == NULL) {
+                StartIO(i, TRUE, FALSE);    // modified while we waited
+            }
+            WaitForIO(cache[i].io);
+        }
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Sync
+//  Flush the cache, and have the disk write the sectors changed since
+//  the last Sync through to its UNIX file.  Called when the file
+//  system is unmounted.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Sync() {
+    Flush();
+    lock->Acquire();
+    disk->Sync();
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Prefetch
+//  Start bringing "sectorNumber" into the cache, and return without
+//  waiting for it.  Nothing is done if the sector is already cached,
+//  if too many prefetches are outstanding, or if no slot can be
+//  reused without first writing it back: a prefetch is only a hint,
+//  and must never make the caller wait.
+//
+//  The slot is taken from among the clean slots that have not been
+//  referenced since the clock hand last passed, and is left
+//  unreferenced itself, so that a sector nobody reads goes first.
+//
+//  "sectorNumber" -- the disk sector that is likely to be read soon
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Prefetch(int sectorNumber) {
+    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+
+    lock->Acquire();
+    if (cacheIndex[sectorNumber] == -1 && numPrefetching < MaxPrefetch) {
+        int slot = -1;
+
+        for (int i = 0; i < NumCacheEntries; i++) {
+            CacheEntry* e = &cache[(clockHand + i) % NumCacheEntries];
+
+            if (!e->used && e->io == NULL && !e->dirty) {
+                slot = (clockHand + i) % NumCacheEntries;
+                break;
+            }
+        }
+
+        if (slot != -1) {
+            if (cache[slot].sector != -1) {
+                kernel->stats->numCacheEvictions++;
+                cacheIndex[cache[slot].sector] = -1;
+            }
+
+            DEBUG(dbgDisk, "Prefetching sector " << sectorNumber);
+            kernel->stats->numPrefetches++;
+            cache[slot].sector = sectorNumber;
+            cache[slot].dirty = FALSE;
+            cache[slot].used = FALSE;
+            cacheIndex[sectorNumber] = slot;
+            StartIO(slot, FALSE, TRUE);
+        }
+    }
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ReadAsync
+//  Start bringing "sectorNumber" into the cache, and return without
+//  waiting for it, unless every cache slot is busy.  Unlike Prefetch,
+//  the read is served with the normal priority, and the caller gets
+//  a handle to it.
+//
+//  Return NULL if the sector is already in the cache.  Otherwise the
+//  handle must be given back with Wait or Release; "whenDone" (if not
+//  NULL) is called from the disk interrupt handler once the sector is
+//  in the cache.
+//
+//  "sectorNumber" -- the disk sector to read
+//  "whenDone" -- object to call when the read completes
+//----------------------------------------------------------------------
+
+DiskRequest*
+SynchDisk::ReadAsync(int sectorNumber, CallBackObj* whenDone) {
+    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+
+    DiskRequest* req = NULL;
+
+    lock->Acquire();
+    for (;;) {
+        int slot = cacheIndex[sectorNumber];
+
+        if (slot != -1) {
+            kernel->stats->numCacheHits++;
+            req = cache[slot].io;   // NULL if already read in
+            break;
+        }
+
+        slot = CleanVictim();
+        if (cacheIndex[sectorNumber] != -1) {
+            continue;           // read in by somebody else meanwhile
+        }
+
+        if (cache[slot].sector != -1) {
+            kernel->stats->numCacheEvictions++;
+            cacheIndex[cache[slot].sector] = -1;
+        }
+        kernel->stats->numCacheMisses++;
+        cache[slot].sector = sectorNumber;
+        cache[slot].dirty = FALSE;
+        cache[slot].used = TRUE;
+        cacheIndex[sectorNumber] = slot;
+        req = StartIO(slot, FALSE, FALSE);
+        break;
+    }
+
+    if (req != NULL) {
+        Notify(req, whenDone);
+    }
+    lock->Release();
+    return req;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteBackAsync
+//  Start writing "sectorNumber" back to disk, if it is modified in the
+//  cache, and return without waiting for it.  The sector stays cached.
+//
+//  Return NULL if there is nothing to write back, or if the sector is
+//  pinned for the journal.  Otherwise the handle must be given back
+//  with Wait or Release; "whenDone" (if not NULL) is called from the
+//  disk interrupt handler once the sector is on disk.
+//
+//  "sectorNumber" -- the disk sector to write back
+//  "whenDone" -- object to call when the write completes
+//----------------------------------------------------------------------
+
+DiskRequest*
+SynchDisk::WriteBackAsync(int sectorNumber, CallBackObj* whenDone) {
+    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+
+    DiskRequest* req = NULL;
+
+    lock->Acquire();
+    int slot = cacheIndex[sectorNumber];
+
+    if (slot != -1 && cache[slot].dirty && !cache[slot].pinned) {
+        if (cache[slot].io != NULL) {
+            req = cache[slot].io;   // already being written back
+        } else {
+            req = StartIO(slot, TRUE, FALSE);
+        }
+        Notify(req, whenDone);
+    }
+    lock->Release();
+    return req;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Wait
+//  Wait for a request handed out by ReadAsync or WriteBackAsync to
+//  complete, and give back the handle.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Wait(DiskRequest* req) {
+    lock->Acquire();
+    if (!req->complete) {
+        WaitForIO(req);
+    }
+    req->holders--;
+    Forget(req);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Release
+//  Give back the handle to a request without waiting for it; the
+//  request still completes, and still notifies its callbacks.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Release(DiskRequest* req) {
+    lock->Acquire();
+    req->holders--;
+    Forget(req);
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::FetchSectors
+//  Start reading into the cache those of "numSectors" sectors, from
+//  "sectorNumber" on, that are not there yet, and return without
+//  waiting for them (unless every cache slot is busy).  The reads are
+//  all queued before any is sent, so that they go to the disk as
+//  few multi-sector transfers.  A later ReadSector of one of the
+//  sectors waits for its transfer.
+//
+//  "sectorNumber" -- the first disk sector of the range
+//  "numSectors" -- how many sectors
+//----------------------------------------------------------------------
+
+void
+SynchDisk::FetchSectors(int sectorNumber, int numSectors) {
+    ASSERT((sectorNumber >= 0) && (sectorNumber + numSectors <= NumSectors));
+
+    lock->Acquire();
+    for (int i = sectorNumber; i < sectorNumber + numSectors; i++) {
+        if (cacheIndex[i] != -1) {
+            cache[cacheIndex[i]].used = TRUE;   // don't evict it for
+        }                                       // the others
+    }
+
+    batching = TRUE;
+    for (int i = sectorNumber; i < sectorNumber + numSectors; i++) {
+        if (cacheIndex[i] == -1) {
+            int slot = CleanVictim();
+
+            if (cacheIndex[i] != -1) {
+                continue;       // read in by somebody else meanwhile
+            }
+
+            if (cache[slot].sector != -1) {
+                kernel->stats->numCacheEvictions++;
+                cacheIndex[cache[slot].sector] = -1;
+            }
+            kernel->stats->numCacheMisses++;
+            cache[slot].sector = i;
+            cache[slot].dirty = FALSE;
+            cache[slot].used = TRUE;
+            cacheIndex[i] = slot;
+            StartIO(slot, FALSE, FALSE);
+        }
+    }
+    batching = FALSE;
+    StartNext();
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteBackSectors
+//  Start writing back those of "numSectors" sectors, from
+//  "sectorNumber" on, that are modified in the cache, and return
+//  without waiting for them.  As for FetchSectors, the writes are
+//  sent to the disk together.
+//
+//  "sectorNumber" -- the first disk sector of the range
+//  "numSectors" -- how many sectors
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WriteBackSectors(int sectorNumber, int numSectors) {
+    ASSERT((sectorNumber >= 0) && (sectorNumber + numSectors <= NumSectors));
+
+    lock->Acquire();
+    batching = TRUE;
+    for (int i = sectorNumber; i < sectorNumber + numSectors; i++) {
+        int slot = cacheIndex[i];
+
+        if (slot != -1 && cache[slot].dirty && !cache[slot].pinned
+                && cache[slot].io == NULL) {
+            StartIO(slot, TRUE, FALSE);
+        }
+    }
+    batching = FALSE;
+    StartNext();
     lock->Release();
 }
 
+//----------------------------------------------------------------------
+// SynchDisk::Unpin
+//  Called by the journal once it has logged "sectorNumber": the
+//  sector can now be written back, and replaced, like any other.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Unpin(int sectorNumber) {
+    lock->Acquire();
+    int slot = cacheIndex[sectorNumber];
+
+    ASSERT(slot != -1);         // pinned slots are never replaced
+    cache[slot].pinned = FALSE;
+    lock->Release();
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WriteThrough
+//  Write "numSectors" sectors, from "sectorNumber" on, straight from
+//  "data" to the disk, without going through the cache, and wait
+//  until they are written.  The requests are queued together, so
+//  they go to the disk as few multi-sector transfers.  Used by the
+//  journal to write its log, which is never read back except after
+//  a crash; cached copies of the sectors are dropped.
+//
+//  "sectorNumber" -- the first disk sector to write
+//  "numSectors" -- how many sectors
+//  "data" -- their contents, one after the other
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WriteThrough(int sectorNumber, int numSectors, char* data) {
+    static char requestDone[20] = "disk request";
+    DiskRequest** reqs = new DiskRequest*[numSectors];
+
+    ASSERT((sectorNumber >= 0) && (sectorNumber + numSectors <= NumSectors));
+
+    lock->Acquire();
+    for (int i = sectorNumber; i < sectorNumber + numSectors; i++) {
+        int slot = cacheIndex[i];
+
+        while (slot != -1 && cache[slot].io != NULL) {
+            WaitForIO(cache[slot].io);
+            slot = cacheIndex[i];
+        }
+        if (slot != -1) {
+            ASSERT(!cache[slot].pinned);
+            cache[slot].sector = -1;
+            cache[slot].dirty = FALSE;
+            cacheIndex[i] = -1;
+        }
+    }
+
+    batching = TRUE;
+    for (int i = 0; i < numSectors; i++) {
+        DiskRequest* req = new DiskRequest;
+
+        req->slot = -1;
+        req->buffer = &data[i * SectorSize];
+        req->sector = sectorNumber + i;
+        req->writing = TRUE;
+        req->prefetch = FALSE;
+        req->complete = FALSE;
+        req->arrival = kernel->stats->totalTicks;
+        req->waiters = 0;
+        req->holders = 1;           // ours, given back by Wait
+        req->done = new Semaphore(requestDone, 0);
+        req->notify = NULL;
+        queue->Append(req);
+        reqs[i] = req;
+    }
+    batching = FALSE;
+    StartNext();
+    lock->Release();
+
+    for (int i = 0; i < numSectors; i++) {
+        Wait(reqs[i]);
+    }
+    delete [] reqs;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::FindSlot
+//  Return the cache slot holding "sectorNumber".  On a miss, a victim
+//  slot is chosen with the CLOCK algorithm, and a dirty victim is
+//  written back before it is reused.
+//
+//  Whenever we wait for the disk, other threads may change the cache,
+//  so after each wait we start over.
+//
+//  The caller must hold the lock.
+//
+//  "sectorNumber" -- the disk sector wanted
+//  "load" -- read the sector from disk on a miss; FALSE when the
+//      caller is about to overwrite the whole sector anyway
+//----------------------------------------------------------------------
+
+int
+SynchDisk::FindSlot(int sectorNumber, bool load) {
+    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+
+    bool counted = FALSE;
+    int victim = -1;
+
+    for (;;) {
+        int slot = cacheIndex[sectorNumber];
+
+        if (!counted) {
+            if (slot != -1) {
+                kernel->stats->numCacheHits++;
+            } else {
+                kernel->stats->numCacheMisses++;
+            }
+            counted = TRUE;
+        }
+
+        if (slot != -1) {
+            if (cache[slot].io != NULL) {
+                WaitForIO(cache[slot].io);    // still being read in, or written back
+                continue;
+            }
+            cache[slot].used = TRUE;
+            return slot;
+        }
+
+        // reuse the victim we just wrote back, unless it changed
+        if (victim == -1 || cache[victim].io != NULL
+                || cache[victim].dirty || cache[victim].used) {
+            victim = ChooseVictim();
+        }
+
+        if (victim == -1) {
+            WaitForIO(cache[clockHand].io);   // every slot is busy
+            continue;
+        }
+
+        if (cache[victim].dirty) {
+            StartIO(victim, TRUE, FALSE);
+            WaitForIO(cache[victim].io);
+            continue;
+        }
+
+        if (cache[victim].sector != -1) {
+            kernel->stats->numCacheEvictions++;
+            cacheIndex[cache[victim].sector] = -1;
+        }
+        cache[victim].sector = sectorNumber;
+        cache[victim].dirty = FALSE;
+        cache[victim].used = TRUE;
+        cacheIndex[sectorNumber] = victim;
+
+        if (!load) {
+            return victim;
+        }
+
+        StartIO(victim, FALSE, FALSE);
+        WaitForIO(cache[victim].io);
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::ChooseVictim
+//  Choose a slot to be replaced, with the CLOCK algorithm: the hand
+//  sweeps the slots, clearing reference bits, and stops at the first
+//  slot that has not been referenced since the last sweep.  Busy slots
+//  and pinned slots are passed over.  Return -1 if every slot is busy.
+//  The caller must hold the lock.
+//----------------------------------------------------------------------
+
+int
+SynchDisk::ChooseVictim() {
+    for (int i = 0; i < 2 * NumCacheEntries; i++) {     // two sweeps at most
+        int slot = clockHand;
+
+        clockHand = (clockHand + 1) % NumCacheEntries;
+        if (!cache[slot].used && cache[slot].io == NULL && !cache[slot].pinned) {
+            return slot;
+        }
+        cache[slot].used = FALSE;
+    }
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::CleanVictim
+//  Choose a slot to be replaced that is neither busy nor dirty.  The
+//  dirty slots the clock hand passes on the way get their write-backs
+//  started, without waiting for them.  If every slot is busy, wait
+//  for one of them.  The caller must hold the lock.
+//----------------------------------------------------------------------
+
+int
+SynchDisk::CleanVictim() {
+    for (;;) {
+        int slot = ChooseVictim();
+
+        if (slot == -1) {
+            WaitForIO(cache[clockHand].io);     // every slot is busy
+        } else if (cache[slot].dirty) {
+            StartIO(slot, TRUE, FALSE);
+        } else {
+            return slot;
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartIO
+//  Queue a request to read a cache slot in from its sector, or write
+//  it back, and send it to the disk if the disk is idle (and we are
+//  not batching requests).  Return without waiting for it.  The
+//  caller must hold the lock.
+//
+//  "slot" -- the cache slot; it must not be busy
+//  "writing" -- write the slot back, rather than read it in
+//  "prefetch" -- nobody needs the sector yet
+//----------------------------------------------------------------------
+
+DiskRequest*
+SynchDisk::StartIO(int slot, bool writing, bool prefetch) {
+    static char requestDone[20] = "disk request";
+    DiskRequest* req = new DiskRequest;
+
+    ASSERT(cache[slot].io == NULL);
+    req->slot = slot;
+    req->buffer = NULL;
+    req->sector = cache[slot].sector;
+    req->writing = writing;
+    req->prefetch = prefetch;
+    req->complete = FALSE;
+    req->arrival = kernel->stats->totalTicks;
+    req->waiters = 0;
+    req->holders = 0;
+    req->done = new Semaphore(requestDone, 0);
+    req->notify = NULL;
+
+    cache[slot].io = req;
+    if (writing) {
+        cache[slot].dirty = FALSE;  // the slot can't change until
+    }                               // the write is done
+    if (prefetch) {
+        numPrefetching++;
+    }
+
+    queue->Append(req);
+    if (!batching) {
+        StartNext();
+    }
+    return req;
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Modified
+//  Mark a slot as modified, and tell the journal (if any), which may
+//  want it held in the cache until it is logged.  The caller must
+//  hold the lock.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Modified(int slot) {
+    cache[slot].dirty = TRUE;
+    if (journal != NULL && journal->Log(cache[slot].sector)) {
+        cache[slot].pinned = TRUE;
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::WaitForIO
+//  Wait for a request that has not completed yet, such as the request
+//  on a busy slot.  A queued prefetch we wait for is served like any
+//  other request from then on.
+//
+//  The lock is released while we wait, and held again on return.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::WaitForIO(DiskRequest* req) {
+    ASSERT(req != NULL && !req->complete);
+    if (req->prefetch) {
+        req->prefetch = FALSE;
+        numPrefetching--;
+    }
+
+    StartNext();                // in case it is held in a batch
+    req->waiters++;
+    lock->Release();
+    req->done->P();             // wait for interrupt
+    lock->Acquire();
+
+    req->waiters--;
+    Forget(req);
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Notify
+//  Give the caller a handle to a request, and arrange for "whenDone"
+//  (if not NULL) to be called when it completes.  The caller must
+//  hold the lock.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Notify(DiskRequest* req, CallBackObj* whenDone) {
+    req->holders++;
+    if (req->prefetch) {        // someone cares about it now
+        req->prefetch = FALSE;
+        numPrefetching--;
+    }
+    if (whenDone != NULL) {
+        if (req->notify == NULL) {
+            req->notify = new List<CallBackObj*>;
+        }
+        req->notify->Append(whenDone);
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Forget
+//  Delete a request, once it has completed and nobody is waiting for
+//  it or holding a handle to it.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::Forget(DiskRequest* req) {
+    if (req->complete && req->waiters == 0 && req->holders == 0) {
+        delete req->notify;
+        delete req->done;
+        delete req;
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::StartNext
+//  If the disk is idle, send it the next queued request, along with
+//  the queued requests of the same kind for the sectors right after
+//  it, as a single transfer.
+//----------------------------------------------------------------------
+
+void
+SynchDisk::StartNext() {
+    if (numCurrent > 0 || queue->IsEmpty()) {
+        return;
+    }
+
+    DiskRequest* first = Schedule();
+    char* data[MaxTransfer];
+
+    current[0] = first;
+    numCurrent = 1;
+    while (numCurrent < MaxTransfer) {
+        DiskRequest* next = NULL;
+        ListIterator<DiskRequest*> iter(queue);
+
+        for (; !iter.IsDone(); iter.Next()) {
+            if (iter.Item()->sector == first->sector + numCurrent
+                    && iter.Item()->writing == first->writing) {
+                next = iter.Item();
+                break;
+            }
+        }
+
+        if (next == NULL) {
+            break;
+        }
+        queue->Remove(next);
+        current[numCurrent++] = next;
+    }
+
+    for (int i = 0; i < numCurrent; i++) {
+        if (current[i]->slot == -1) {
+            data[i] = current[i]->buffer;
+        } else {
+            data[i] = cache[current[i]->slot].data;
+        }
+    }
+    kernel->stats->diskSeekTracks
+        += abs(first->sector / SectorsPerTrack - disk->CurrentTrack());
+
+    if (first->writing) {
+        disk->WriteRequest(first->sector, numCurrent, data);
+    } else {
+        disk->ReadRequest(first->sector, numCurrent, data);
+    }
+}
+
+//----------------------------------------------------------------------
+// SynchDisk::Schedule
+//  Take the request to be served next off the queue.  Requests some
+//  thread is waiting for go before prefetches.  Among those, the
+//  policy decides:
+//
+//      FCFS -- the oldest request
+//      SSTF -- the request the disk can get to soonest, according
+//          to its model of seek, rotation and track buffer
+//      SCAN -- the nearest request in the direction the head is
+//          moving; when there is none, the head turns around
+//      C-LOOK -- the nearest request at or above the head's track;
+//          when there is none, the lowest one
+//
+//  Requests on the same track are taken in the order SSTF would.
+//  The queue must not be empty.
+//----------------------------------------------------------------------
+
+DiskRequest*
+SynchDisk::Schedule() {
+    bool waitedFor = FALSE;     // any request that is not a prefetch?
+    int head = disk->CurrentTrack();
+    DiskRequest* best = NULL;
+    int bestDistance = 0, bestLatency = 0;
+    ListIterator<DiskRequest*> iter(queue);
+
+    for (; !iter.IsDone(); iter.Next()) {
+        if (!iter.Item()->prefetch) {
+            waitedFor = TRUE;
+        }
+    }
+
+    for (int pass = 0; best == NULL && pass < 2; pass++) {
+        ListIterator<DiskRequest*> it(queue);
+
+        for (; !it.IsDone(); it.Next()) {
+            DiskRequest* req = it.Item();
+            int track = req->sector / SectorsPerTrack;
+            int distance = 0, latency = 0;
+
+            if (waitedFor && req->prefetch) {
+                continue;
+            }
+
+            switch (policy) {
+            case DiskFCFS:
+                break;
+
+            case DiskSSTF:
+                latency = disk->ComputeLatency(req->sector, req->writing);
+                break;
+
+            case DiskSCAN:
+                if (sweepUp ? (track < head) : (track > head)) {
+                    continue;
+                }
+                distance = abs(track - head);
+                latency = disk->ComputeLatency(req->sector, req->writing);
+                break;
+
+            case DiskCLOOK:
+                if (pass == 0 && track < head) {
+                    continue;
+                }
+                distance = (pass == 0) ? track - head : track;
+                latency = disk->ComputeLatency(req->sector, req->writing);
+                break;
+            }
+
+            if (best == NULL || distance < bestDistance
+                    || (distance == bestDistance && latency < bestLatency)) {
+                best = req;
+                bestDistance = distance;
+                bestLatency = latency;
+            }
+        }
+
+        if (best == NULL && policy == DiskSCAN) {
+            sweepUp = !sweepUp;
+        }
+    }
+
+    ASSERT(best != NULL);
+    queue->Remove(best);
+    return best;
+}
+
 //----------------------------------------------------------------------
 // SynchDisk::CallBack
-//  Disk interrupt handler.  Wake up any thread waiting for the disk
-//  request to finish.
+//  Disk interrupt handler.  Wake up the threads waiting for the
+//  requests that just completed, send the next ones to the disk, and
+//  then call the objects asked to be notified of the completions.
+//  Like any interrupt handler, those must not wait.
 //----------------------------------------------------------------------
 
 void
 SynchDisk::CallBack() {
-    semaphore->V();
+    DiskRequest* done[MaxTransfer];
+    int numDone = numCurrent;
+
+    for (int i = 0; i < numDone; i++) {
+        DiskRequest* req = current[i];
+
+        done[i] = req;
+        kernel->stats->numDiskRequests++;
+        kernel->stats->diskLatency += kernel->stats->totalTicks - req->arrival;
+
+        req->complete = TRUE;
+        if (req->slot != -1) {
+            cache[req->slot].io = NULL;
+        }
+        if (req->prefetch) {
+            numPrefetching--;
+        }
+
+        for (int j = 0; j < req->waiters; j++) {
+            req->done->V();
+        }
+    }
+
+    numCurrent = 0;
+    StartNext();                // keep the disk busy
+
+    for (int i = 0; i < numDone; i++) {
+        if (done[i]->notify != NULL) {
+            ListIterator<CallBackObj*> iter(done[i]->notify);
+
+            for (; !iter.IsDone(); iter.Next()) {
+                iter.Item()->CallBack();
+            }
+        }
+        Forget(done[i]);
+    }
 }
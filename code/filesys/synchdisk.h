@@ -15,6 +15,70 @@
 #include "synch.h"
 #include "callback.h"
 
+// Number of sectors kept in the SynchDisk sector cache.
+const int NumCacheEntries = 64;
+
+// Most sectors that may be queued for prefetching at once.
+const int MaxPrefetch = 16;
+
+// Most sectors moved by a single request to the physical disk.
+const int MaxTransfer = 16;
+
+// The policies for choosing which queued disk request goes next.
+enum DiskSchedulerType {
+    DiskFCFS,               // in order of arrival
+    DiskSSTF,               // least positioning time first
+    DiskSCAN,               // sweep back and forth across the tracks
+    DiskCLOOK               // sweep up the tracks, then jump back
+};
+
+class DiskRequest;
+class Journal;
+
+// The following class defines one slot of the sector cache.  A slot
+// holds a copy of one disk sector; "dirty" slots have been modified
+// since they were read, and must be written back before they are reused.
+// "used" is the reference bit consulted by the CLOCK replacement policy.
+// A slot with "io" set has a read or write-back queued or in progress;
+// it is never chosen for replacement, and its contents may not be
+// touched until the request completes.  A "pinned" slot is held for
+// the metadata journal: it may not be written back (or replaced) until
+// the journal has logged it.
+
+class CacheEntry {
+public:
+    int sector;             // Disk sector held here, -1 if none
+    bool dirty;             // Modified since read from disk?
+    bool used;              // Referenced since the clock hand passed?
+    DiskRequest* io;        // Request on this slot, NULL if none
+    bool pinned;            // Held until the journal logs it?
+    char* data;             // Contents of the sector
+};
+
+// The following class defines a request queued for the physical disk:
+// a read of a sector into a cache slot, or a write of a cache slot
+// back to its sector.  Threads waiting for the request sleep on "done".
+// A request is also the handle returned by the asynchronous interface
+// of SynchDisk; it is deleted once it has completed, nobody is waiting
+// for it, and every handle to it has been given back.  A request that
+// bypasses the cache has no slot, and its own buffer.
+
+class DiskRequest {
+public:
+    int slot;               // Cache slot read into/written from,
+    // -1 if none
+    char* buffer;           // Data written, if there is no slot
+    int sector;             // Disk sector
+    bool writing;           // Write-back, or read?
+    bool prefetch;          // Is nobody waiting for it yet?
+    bool complete;          // Has the disk finished with it?
+    int arrival;            // When it was queued, in ticks
+    int waiters;            // Threads waiting for it to complete
+    int holders;            // Handles given out and not yet returned
+    Semaphore* done;        // Signalled once per waiter on completion
+    List<CallBackObj*>* notify; // Called on completion, NULL if none
+};
+
 // The following class defines a "synchronous" disk abstraction.
 // As with other I/O devices, the raw physical disk is an asynchronous device --
 // requests to read or write portions of the disk return immediately,
@@ -25,6 +89,42 @@
 // This class provides the abstraction that for any individual thread
 // making a request, it waits around until the operation finishes before
 // returning.
+//
+// Sectors are cached in memory, so a request that hits in the cache
+// returns without touching the disk at all.  Writes only update the
+// cache; modified sectors go to disk when they are evicted, or when
+// Flush is called.
+//
+// Requests that do go to the disk are queued, and the interrupt
+// handler sends the next one as soon as the disk is free, together
+// with the queued requests for the sectors that follow it, as one
+// multi-sector transfer.  Threads do
+// not hold the lock while they wait for the disk, so several threads
+// can have requests queued at once; the scheduling policy picks which
+// of them is served next, using the disk's model of seek and rotation
+// times.  Flush queues all of its write-backs at once, so they too
+// are served in the policy's order.
+//
+// Prefetch asks for a sector to be brought into the cache without
+// waiting for it.  Prefetches are queued like other requests, but
+// are only served when no thread is waiting for the disk -- unless
+// a thread comes to need the sector being prefetched.
+//
+// ReadAsync and WriteBackAsync also start a transfer without waiting
+// for it, but at the normal priority, and return a handle to the
+// request.  The caller can go on computing, and later Wait for the
+// request, or be told of its completion through a CallBackObj, just
+// as SynchDisk itself is told by the Disk.  Every handle must be given
+// back, with Wait or Release.
+//
+// FetchSectors and WriteBackSectors start the transfers for a whole
+// range of sectors, queueing them all before any is sent, so that
+// they go to the disk as a few multi-sector transfers.
+//
+// When the file system has a journal, every modified sector is
+// reported to it; those it wants logged stay pinned in the cache
+// until it calls Unpin.  The journal writes its log with
+// WriteThrough, which does not go through the cache.
 
 class SynchDisk : public CallBackObj {
 public:
@@ -40,16 +140,92 @@ public:
     // then wait until the request is done.
     void WriteSector(int sectorNumber, char* data);
 
+    void ReadPartial(int sectorNumber, char* into, int offset, int numBytes);
+    // Copy part of a sector out of/into
+    // the cache, without going through
+    // a sector-sized buffer
+    void WritePartial(int sectorNumber, char* from, int offset, int numBytes);
+    void ZeroSector(int sectorNumber);  // Fill a sector with zeros
+
+    void Flush();               // Write all modified cached sectors
+    // back to disk
+    void Sync();                // Flush, and have the disk write
+    // them through to its UNIX file
+
+    void Prefetch(int sectorNumber);    // Start reading a sector into the
+    // cache, without waiting for it
+
+    DiskRequest* ReadAsync(int sectorNumber, CallBackObj* whenDone);
+    // Start reading a sector into the
+    // cache; NULL if it is there already
+    DiskRequest* WriteBackAsync(int sectorNumber, CallBackObj* whenDone);
+    // Start writing a modified cached
+    // sector back; NULL if it is clean
+    bool IsDone(DiskRequest* req) {
+        return req->complete;
+    }
+    void Wait(DiskRequest* req);        // Wait for a request to complete,
+    // and give back its handle
+    void Release(DiskRequest* req);     // Give back a handle without
+    // waiting
+
+    void FetchSectors(int sectorNumber, int numSectors);
+    // Start reading the uncached sectors
+    // of a range into the cache
+    void WriteBackSectors(int sectorNumber, int numSectors);
+    // Start writing back the modified
+    // sectors of a range
+
+    void UseJournal(Journal* j) {
+        journal = j;    // Report modified sectors to "j"
+    }
+    void Unpin(int sectorNumber);       // The journal has logged a sector
+    void WriteThrough(int sectorNumber, int numSectors, char* data);
+    // Write sectors straight to disk,
+    // and wait for them
+
     void CallBack();            // Called by the disk device interrupt
     // handler, to signal that the
     // current disk operation is complete.
 
 private:
     Disk* disk;             // Raw disk device
-    Semaphore* semaphore;       // To synchronize requesting thread
-    // with the interrupt handler
-    Lock* lock;             // Only one read/write request
-    // can be sent to the disk at a time
+    Lock* lock;             // Protects the cache and the queue
+
+    CacheEntry* cache;          // The sector cache
+    int* cacheIndex;            // Cache slot holding each disk sector,
+    // -1 if the sector is not cached
+    int clockHand;              // Next slot examined for replacement
+
+    DiskSchedulerType policy;   // How the next request is chosen
+    List<DiskRequest*>* queue;  // Requests not yet sent to the disk
+    DiskRequest* current[MaxTransfer];  // Requests on the disk
+    int numCurrent;             // How many, 0 if the disk is idle
+    bool batching;              // Hold requests in the queue, to be
+    // sent together?
+    bool sweepUp;               // SCAN: moving to higher tracks?
+    int numPrefetching;         // Prefetches queued or in progress
+    Journal* journal;           // Told of modified sectors, if not NULL
+
+    int FindSlot(int sectorNumber, bool load);
+    // Return the cache slot holding a
+    // sector, evicting another sector
+    // and (if "load") reading it in
+    // when it is not cached
+    int ChooseVictim();         // Pick a slot to replace, -1 if
+    // every slot is busy
+    int CleanVictim();          // Pick a clean slot to replace,
+    // starting write-backs of dirty ones
+    DiskRequest* StartIO(int slot, bool writing, bool prefetch);
+    // Queue a request on a slot
+    void WaitForIO(DiskRequest* req);   // Wait for a request to complete
+    void Modified(int slot);    // Mark a slot dirty, and tell the journal
+    void Notify(DiskRequest* req, CallBackObj* whenDone);
+    // Hand out a handle to a request
+    void Forget(DiskRequest* req);      // Delete a request if nobody
+    // needs it any more
+    void StartNext();           // Send the next requests to the disk
+    DiskRequest* Schedule();    // Take the next request off the queue
 };
 
 #endif // SYNCHDISK_H
@@ -31,9 +31,9 @@ Bitmap::Bitmap(int numItems) {
         map[i] = 0;     // initialize map to keep Purify happy
     }
 
-    for (i = 0; i < numBits; i++) {
-        Clear(i);
-    }
+    numSummaryWords = divRoundUp(numWords, BitsInWord);
+    summary = new unsigned int[numSummaryWords];
+    Rebuild();
 }
 
 //----------------------------------------------------------------------
@@ -43,6 +43,67 @@ Bitmap::Bitmap(int numItems) {
 
 Bitmap::~Bitmap() {
     delete [] map;
+    delete [] summary;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::WordBits
+//  Return word "word" of the map, with the bits beyond the end of
+//  the bitmap reported as set, so that they are never handed out.
+//----------------------------------------------------------------------
+
+unsigned int
+Bitmap::WordBits(int word) const {
+    int valid = numBits - word * BitsInWord;
+
+    if (valid >= BitsInWord) {
+        return map[word];
+    }
+
+    return map[word] | (~0u << valid);
+}
+
+//----------------------------------------------------------------------
+// Bitmap::UpdateSummary
+//  Set or clear the summary bit of map word "word", depending on
+//  whether the word is now full.
+//----------------------------------------------------------------------
+
+void
+Bitmap::UpdateSummary(int word) {
+    unsigned int bit = 1u << (word % BitsInWord);
+
+    if (WordBits(word) == ~0u) {
+        summary[word / BitsInWord] |= bit;
+    } else {
+        summary[word / BitsInWord] &= ~bit;
+
+        if (word / BitsInWord < summaryHint) {
+            summaryHint = word / BitsInWord;
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// Bitmap::Rebuild
+//  Recompute the summary level and the clear count from scratch.
+//  Called whenever the whole map has been replaced, for instance
+//  when a persistent bitmap is read in from disk.
+//----------------------------------------------------------------------
+
+void
+Bitmap::Rebuild() {
+    numClear = 0;
+    summaryHint = 0;
+
+    for (int i = 0; i < numSummaryWords; i++) {
+        summary[i] = 0;
+    }
+
+    for (int i = 0; i < numWords; i++) {
+        numClear += BitsInWord - __builtin_popcount(WordBits(i));
+        UpdateSummary(i);
+    }
 }
 
 //----------------------------------------------------------------------
@@ -56,7 +117,15 @@ void
 Bitmap::Mark(int which) {
     ASSERT(which >= 0 && which < numBits);
 
-    map[which / BitsInWord] |= 1 << (which % BitsInWord);
+    unsigned int bit = 1u << (which % BitsInWord);
+    int word = which / BitsInWord;
+
+    if (!(map[word] & bit)) {
+        map[word] |= bit;
+        numClear--;
+        UpdateSummary(word);
+        Changed(word);
+    }
 
     ASSERT(Test(which));
 }
@@ -72,7 +141,15 @@ void
 Bitmap::Clear(int which) {
     ASSERT(which >= 0 && which < numBits);
 
-    map[which / BitsInWord] &= ~(1 << (which % BitsInWord));
+    unsigned int bit = 1u << (which % BitsInWord);
+    int word = which / BitsInWord;
+
+    if (map[word] & bit) {
+        map[word] &= ~bit;
+        numClear++;
+        UpdateSummary(word);
+        Changed(word);
+    }
 
     ASSERT(!Test(which));
 }
@@ -88,7 +165,7 @@ bool
 Bitmap::Test(int which) const {
     ASSERT(which >= 0 && which < numBits);
 
-    if (map[which / BitsInWord] & (1 << (which % BitsInWord))) {
+    if (map[which / BitsInWord] & (1u << (which % BitsInWord))) {
         return TRUE;
     } else {
         return FALSE;
@@ -101,38 +178,154 @@ Bitmap::Test(int which) const {
 //  As a side effect, set the bit (mark it as in use).
 //  (In other words, find and allocate a bit.)
 //
+//  The summary tells us the first word that is not full; within
+//  that word, the first clear bit is found by counting trailing ones.
+//
 //  If no bits are clear, return -1.
 //----------------------------------------------------------------------
 
 int
 Bitmap::FindAndSet() {
-    for (int i = 0; i < numBits; i++) {
-        if (!Test(i)) {
-            Mark(i);
-            return i;
+    if (numClear == 0) {
+        return -1;
+    }
+
+    for (int i = summaryHint; i < numSummaryWords; i++) {
+        if (summary[i] == ~0u) {
+            summaryHint = i + 1;    // everything below is full
+            continue;
         }
+
+        int word = i * BitsInWord + __builtin_ctz(~summary[i]);
+
+        if (word >= numWords) {
+            break;
+        }
+
+        int which = word * BitsInWord + __builtin_ctz(~WordBits(word));
+        Mark(which);
+        return which;
     }
 
+    ASSERTNOTREACHED();         // numClear said there was a clear bit
     return -1;
 }
 
 //----------------------------------------------------------------------
-// Bitmap::NumClear
-//  Return the number of clear bits in the bitmap.
-//  (In other words, how many bits are unallocated?)
+// Bitmap::FindAndSetRun
+//  Return the number of the first bit of the lowest run of "count"
+//  consecutive clear bits.  As a side effect, set all the bits of
+//  the run.  Used to allocate contiguous disk sectors.
+//
+//  If there is no such run, return -1.
+//
+//  "count" is the length of the run wanted.
 //----------------------------------------------------------------------
 
 int
-Bitmap::NumClear() const {
-    int count = 0;
+Bitmap::FindAndSetRun(int count) {
+    ASSERT(count > 0);
 
-    for (int i = 0; i < numBits; i++) {
-        if (!Test(i)) {
-            count++;
+    if (count == 1) {
+        return FindAndSet();
+    }
+
+    int runStart = FindRun(count);
+
+    if (runStart != -1) {
+        for (int j = runStart; j < runStart + count; j++) {
+            Mark(j);
+        }
+    }
+
+    return runStart;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::FindRun
+//  Return the number of the first bit of the lowest run of "count"
+//  consecutive clear bits, or -1 if there is none, leaving the bits
+//  as they are.
+//
+//  The search starts at the first summary word that is not full, and
+//  uses the summary to skip full words (a whole summary word of them
+//  at a time) without looking at them.  Completely clear words extend
+//  the current run by a whole word at once; only the partly used
+//  words are looked at bit by bit.
+//
+//  "count" is the length of the run wanted.
+//----------------------------------------------------------------------
+
+int
+Bitmap::FindRun(int count) {
+    ASSERT(count > 0);
+
+    if (count > numClear) {
+        return -1;
+    }
+
+    int runStart = 0;
+    int runLength = 0;
+
+    for (int i = summaryHint; i < numSummaryWords; i++) {
+        if (summary[i] == ~0u) {
+            if (i == summaryHint) {
+                summaryHint = i + 1;    // everything below is full
+            }
+            runLength = 0;
+            continue;
+        }
+
+        int last = (i + 1) * BitsInWord;
+
+        if (last > numWords) {
+            last = numWords;
+        }
+
+        for (int word = i * BitsInWord; word < last; word++) {
+            if (summary[i] & (1u << (word % BitsInWord))) {
+                runLength = 0;          // full word
+                continue;
+            }
+
+            unsigned int bits = WordBits(word);
+
+            if (bits == 0 && runLength + BitsInWord < count) {
+                if (runLength == 0) {
+                    runStart = word * BitsInWord;
+                }
+                runLength += BitsInWord;
+                continue;
+            }
+
+            for (int b = 0; b < BitsInWord; b++) {
+                if (bits & (1u << b)) {
+                    runLength = 0;
+                } else {
+                    if (runLength == 0) {
+                        runStart = word * BitsInWord + b;
+                    }
+
+                    if (++runLength == count) {
+                        return runStart;
+                    }
+                }
+            }
         }
     }
 
-    return count;
+    return -1;
+}
+
+//----------------------------------------------------------------------
+// Bitmap::NumClear
+//  Return the number of clear bits in the bitmap.
+//  (In other words, how many bits are unallocated?)
+//----------------------------------------------------------------------
+
+int
+Bitmap::NumClear() const {
+    return numClear;
 }
 
 //----------------------------------------------------------------------
@@ -184,6 +377,23 @@ Bitmap::SelfTest() {
 
     ASSERT(FindAndSet() == -1);     // bitmap should be full!
 
+    Clear(5);
+    Clear(6);
+    Clear(9);
+    ASSERT(FindAndSetRun(3) == -1); // no run of 3 left
+    ASSERT(FindAndSetRun(2) == 5);
+    ASSERT(FindAndSetRun(1) == 9);
+
+    for (i = 0; i < numBits; i++) {
+        Clear(i);
+    }
+
+    ASSERT(NumClear() == numBits);
+    Mark(3);
+    ASSERT(FindAndSetRun(BitsInWord) == 4);   // run spanning two words
+    ASSERT(NumClear() == numBits - BitsInWord - 1);
+    ASSERT(FindAndSet() == 0);
+
     for (i = 0; i < numBits; i++) {
         Clear(i);
     }
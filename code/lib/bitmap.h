@@ -5,6 +5,12 @@
 //  Represented as an array of unsigned integers, on which we do
 //  modulo arithmetic to find the bit we are interested in.
 //
+//  On top of the bits themselves, we keep a summary level with one
+//  bit per word of the map (set when the word is full), and a count
+//  of the clear bits.  Searches skip full words using the summary, and
+//  look inside a word with a single find-first-zero instruction, so
+//  allocation does not slow down as the bitmap grows.
+//
 //  The bitmap can be parameterized with with the number of bits being
 //  managed.
 //
@@ -34,7 +40,7 @@ class Bitmap {
 public:
     Bitmap(int numItems);   // Initialize a bitmap, with "numItems" bits
     // initially, all bits are cleared.
-    ~Bitmap();          // De-allocate bitmap
+    virtual ~Bitmap();  // De-allocate bitmap
 
     void Mark(int which);       // Set the "nth" bit
     void Clear(int which);      // Clear the "nth" bit
@@ -42,6 +48,11 @@ public:
     int FindAndSet();         // Return the # of a clear bit, and as a side
     // effect, set the bit.
     // If no bits are clear, return -1.
+    int FindAndSetRun(int count);   // Return the # of the first bit of a
+    // run of "count" clear bits, and set
+    // them all.  If there is no such run,
+    // return -1.
+    int FindRun(int count);     // The same, without setting them
     int NumClear() const;   // Return the number of clear bits
 
     void Print() const;     // Print contents of bitmap
@@ -54,6 +65,24 @@ protected:
     //  multiple of the number of bits in
     //  a word)
     unsigned int* map;      // bit storage
+
+    void Rebuild();     // Recompute the summary and the clear
+    // count after "map" has been
+    // overwritten as a whole
+    virtual void Changed(int word) {}   // Called when a bit of map
+    // word "word" is set or cleared
+
+private:
+    int numSummaryWords;    // number of words of summary storage
+    unsigned int* summary;  // bit i set <=> map word i is full
+    int summaryHint;        // no summary word below this one
+    // has a full-word clear bit
+    int numClear;           // number of clear bits in the map
+
+    unsigned int WordBits(int word) const;
+    // map word with the unused bits
+    // past numBits forced to 1
+    void UpdateSummary(int word);   // Refresh the summary bit of "word"
 };
 
 #endif // BITMAP_H
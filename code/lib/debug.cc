@@ -24,6 +24,24 @@
 
 Debug::Debug(char* flagList) {
     enableFlags = flagList;
+
+    // IsEnabled is asked for every instruction a user program runs,
+    // so the answers are worked out once here
+    for (int i = 0; i < NumDebugFlags; i++) {
+        enabled[i] = FALSE;
+    }
+
+    if (flagList != NULL) {
+        for (char* flag = flagList; *flag != '\0'; flag++) {
+            enabled[(unsigned char) *flag] = TRUE;
+        }
+
+        if (strchr(flagList, dbgAll) != NULL) {
+            for (int i = 0; i < NumDebugFlags; i++) {
+                enabled[i] = TRUE;
+            }
+        }
+    }
 }
 
 
@@ -34,10 +52,5 @@ Debug::Debug(char* flagList) {
 
 bool
 Debug::IsEnabled(char flag) {
-    if (enableFlags != NULL) {
-        return ((strchr(enableFlags, flag) != 0)
-                || (strchr(enableFlags, '+') != 0));
-    } else {
-        return FALSE;
-    }
+    return enabled[(unsigned char) flag];
 }
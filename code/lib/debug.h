@@ -30,6 +30,8 @@ const char dbgAddr = 'a';       // address spaces
 const char dbgNet = 'n';        // network emulation
 const char dbgSys = 'u';                // systemcall
 
+const int NumDebugFlags = 256;  // one for each value of a char
+
 class Debug {
 public:
     Debug(char* flagList);
@@ -38,6 +40,7 @@ public:
 
 private:
     char* enableFlags;      // controls which DEBUG messages are printed
+    bool enabled[NumDebugFlags];    // is each flag in enableFlags?
 };
 
 extern Debug* debug;
@@ -32,6 +32,7 @@
 #include <sys/file.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 #include <cerrno>
 
 #ifdef SOLARIS
@@ -393,6 +394,51 @@ Close(int fd) {
     return retVal;
 }
 
+//----------------------------------------------------------------------
+// MapFile
+//  Map the first "length" bytes of an open file into our address
+//  space, shared, so that stores into the mapping change the file.
+//  Return NULL if the file can't be mapped.
+//----------------------------------------------------------------------
+
+char*
+MapFile(int fd, int length) {
+    void* addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+
+    return (char*) addr;
+}
+
+//----------------------------------------------------------------------
+// SyncMappedFile
+//  Write the pages of a mapped file that hold bytes "offset" through
+//  "offset" + "length" - 1 back to the file.  Abort on error.
+//
+//  "addr" -- where the file is mapped, as returned by MapFile
+//----------------------------------------------------------------------
+
+void
+SyncMappedFile(char* addr, int offset, int length) {
+    int page = getpagesize();
+    int first = offset - offset % page;     // msync wants whole pages
+    int retVal = msync(addr + first, offset + length - first, MS_SYNC);
+    ASSERT(retVal == 0);
+}
+
+//----------------------------------------------------------------------
+// UnmapFile
+//  Undo MapFile.  Abort on error.
+//----------------------------------------------------------------------
+
+void
+UnmapFile(char* addr, int length) {
+    int retVal = munmap(addr, length);
+    ASSERT(retVal == 0);
+}
+
 //----------------------------------------------------------------------
 // Unlink
 //  Delete a file.
@@ -51,6 +51,9 @@ extern void WriteFile(int fd, char* buffer, int nBytes);
 extern void Lseek(int fd, int offset, int whence);
 extern int Tell(int fd);
 extern int Close(int fd);
+extern char* MapFile(int fd, int length);
+extern void SyncMappedFile(char* addr, int offset, int length);
+extern void UnmapFile(char* addr, int length);
 extern bool Unlink(char* name);
 
 // Other C library routines that are used by Nachos.
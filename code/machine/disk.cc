@@ -7,7 +7,8 @@
 //  Disk operations are asynchronous, so we have to invoke an interrupt
 //  handler when the simulated operation completes.
 //
-//  DO NOT CHANGE -- part of the machine emulation
+//  Part of the machine emulation; the disk geometry is the one
+//  thing that may be chosen when a disk image is created.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -22,59 +23,215 @@
 // We put a magic number at the front of the UNIX file representing the
 // disk, to make it less likely we will accidentally treat a useful file
 // as a disk (which would probably trash the file's contents).
-
-const int MagicNumber = 0x456789ab;
+//
+// The magic number is followed by the superblock: the sector size,
+// the sectors per track and the number of tracks.  Disks made before
+// the geometry was configurable have OldMagicNumber and no superblock.
+// Their geometry cannot be told for sure, so they are refused, as is
+// an image whose superblock is bad or whose UNIX file is too short to
+// hold the sectors it describes -- unless the disk is being formatted
+// anyway, in which case a new image is made.
+
+const int MagicNumber = 0x456789ac;
+const int OldMagicNumber = 0x456789ab;
 const int MagicSize = sizeof(int);
-const int DiskSize = (MagicSize + (NumSectors* SectorSize));
+const int SuperblockSize = 3 * sizeof(int);
+
+int SectorSize = DefaultSectorSize;
+int SectorsPerTrack = DefaultSectorsPerTrack;
+int NumTracks = DefaultNumTracks;
+int NumSectors = DefaultSectorsPerTrack * DefaultNumTracks;
 
 
+//----------------------------------------------------------------------
+// CheckImage
+//  Check the header at the front of a disk image: the magic number,
+//  and a superblock describing a geometry we can use, that fits in
+//  "fileSize" bytes.  Return NULL if it is fine, or else why not.
+//----------------------------------------------------------------------
+
+static const char*
+CheckImage(int* header, int headerBytes, int fileSize) {
+    if (headerBytes >= MagicSize && header[0] == OldMagicNumber) {
+        return "was made by an older version of Nachos";
+    }
+
+    if (headerBytes < MagicSize + SuperblockSize || header[0] != MagicNumber) {
+        return "is not a Nachos disk";
+    }
+
+    int sectorSize = header[1];
+    int sectorsPerTrack = header[2];
+    int numTracks = header[3];
+
+    if (sectorSize < MinSectorSize || sectorSize > MaxSectorSize
+            || (sectorSize & (sectorSize - 1)) != 0
+            || sectorsPerTrack <= 0 || numTracks <= 0
+            || (long long) sectorsPerTrack * numTracks * sectorSize > MaxDiskSize) {
+        return "has a bad superblock";
+    }
+
+    if (fileSize < headerBytes + sectorsPerTrack * numTracks * sectorSize) {
+        return "is shorter than its superblock says";
+    }
+
+    return NULL;
+}
+
 //----------------------------------------------------------------------
 // Disk::Disk()
 //  Initialize a simulated disk.  Open the UNIX file (creating it
 //  if it doesn't exist), and check the magic number to make sure it's
-//  ok to treat it as Nachos disk storage.
+//  ok to treat it as Nachos disk storage.  The geometry of the disk
+//  is read from its superblock.  Then map the file into memory.
+//  An image that cannot be used -- made by an older version of Nachos,
+//  with a bad superblock, or cut short -- is refused, unless it is
+//  about to be formatted.
+//
+//  If a disk size or sector size was given on the command line, the
+//  UNIX file is created afresh with that geometry instead.
 //
 //  "toCall" -- object to call when disk read/write request completes
 //----------------------------------------------------------------------
 
 Disk::Disk(CallBackObj* toCall) {
-    int magicNum;
-    int tmp = 0;
+    int header[4];              // magic number, then the superblock
 
     DEBUG(dbgDisk, "Initializing the disk.");
     callWhenDone = toCall;
     lastSector = 0;
     bufferInit = 0;
+    syncFrom = 1;
+    syncTo = 0;                 // nothing written yet
 
     sprintf(diskname, "DISK_%d", kernel->hostName);
     fileno = OpenForReadWrite(diskname, FALSE);
 
-    if (fileno >= 0) {          // file exists, check magic number
-        Read(fileno, (char*) &magicNum, MagicSize);
-        ASSERT(magicNum == MagicNumber);
-    } else {                // file doesn't exist, create it
-        fileno = OpenForWrite(diskname);
-        magicNum = MagicNumber;
-        WriteFile(fileno, (char*) &magicNum, MagicSize);  // write magic number
-
-        // need to write at end of file, so that reads will not return EOF
-        Lseek(fileno, DiskSize - sizeof(int), 0);
-        WriteFile(fileno, (char*)&tmp, sizeof(int));
+    bool keep = (fileno >= 0 && kernel->diskSize == 0 && kernel->diskSectorSize == 0);
+
+    if (keep) {
+        // file exists, check magic number and superblock
+        int headerBytes = ReadPartial(fileno, (char*) header, sizeof(header));
+        Lseek(fileno, 0, 2);
+        const char* problem = CheckImage(header, headerBytes, Tell(fileno));
+
+        if (problem != NULL) {
+            if (!kernel->formatFlag) {
+                cerr << diskname << " " << problem << "; "
+                     << "reformat it with -f\n";
+                Exit(1);
+            }
+
+            keep = FALSE;       // being formatted anyway: start afresh
+        }
+    }
+
+    if (keep) {
+        headerSize = MagicSize + SuperblockSize;
+
+        SectorSize = header[1];
+        SectorsPerTrack = header[2];
+        NumTracks = header[3];
+        NumSectors = SectorsPerTrack * NumTracks;
+    } else {                // file doesn't exist (or is refused), create it
+        if (fileno >= 0) {
+            Close(fileno);
+        }
+
+        CreateImage(kernel->diskSize, kernel->diskSectorSize);
     }
 
+    ASSERT(SectorSize >= MinSectorSize && SectorSize <= MaxSectorSize);
+    mappingSize = headerSize + NumSectors * SectorSize;
+#ifndef NOMMAPDISK
+    mapping = MapFile(fileno, mappingSize);
+#else
+    mapping = NULL;
+#endif
+    DEBUG(dbgDisk, "Disk geometry: " << NumTracks << " tracks of "
+          << SectorsPerTrack << " sectors of " << SectorSize << " bytes");
     active = FALSE;
 }
 
+//----------------------------------------------------------------------
+// Disk::CreateImage()
+//  Create the UNIX file for a new disk, and set the disk geometry.
+//  Tracks keep the default number of sectors; the disk gets as many
+//  tracks as fit in "diskSize" bytes.
+//
+//  "diskSize" -- bytes of disk storage, 0 for the default
+//  "sectorSize" -- bytes per sector, 0 for the default; must be a
+//      power of two
+//----------------------------------------------------------------------
+
+void
+Disk::CreateImage(int diskSize, int sectorSize) {
+    int magicNum = MagicNumber;
+    int superblock[3];
+    int tmp = 0;
+
+    SectorSize = (sectorSize > 0) ? sectorSize : DefaultSectorSize;
+    ASSERT(SectorSize >= MinSectorSize && SectorSize <= MaxSectorSize);
+    ASSERT((SectorSize & (SectorSize - 1)) == 0);
+    SectorsPerTrack = DefaultSectorsPerTrack;
+
+    if (diskSize > 0) {
+        NumTracks = diskSize / (SectorSize * SectorsPerTrack);
+    } else {
+        NumTracks = DefaultNumTracks;
+    }
+
+    ASSERT(NumTracks > 0);
+    NumSectors = SectorsPerTrack * NumTracks;
+
+    superblock[0] = SectorSize;
+    superblock[1] = SectorsPerTrack;
+    superblock[2] = NumTracks;
+    headerSize = MagicSize + SuperblockSize;
+
+    fileno = OpenForWrite(diskname);
+    WriteFile(fileno, (char*) &magicNum, MagicSize);  // write magic number
+    WriteFile(fileno, (char*) superblock, SuperblockSize);
+
+    // need to write at end of file, so that reads will not return EOF
+    Lseek(fileno, headerSize + NumSectors * SectorSize - sizeof(int), 0);
+    WriteFile(fileno, (char*)&tmp, sizeof(int));
+}
+
 //----------------------------------------------------------------------
 // Disk::~Disk()
-//  Clean up disk simulation, by closing the UNIX file representing the
-//  disk.
+//  Clean up disk simulation, by writing back the mapping and closing
+//  the UNIX file representing the disk.
 //----------------------------------------------------------------------
 
 Disk::~Disk() {
+    if (mapping != NULL) {
+        Sync();
+        UnmapFile(mapping, mappingSize);
+    }
+
     Close(fileno);
 }
 
+//----------------------------------------------------------------------
+// Disk::Sync()
+//  Write the mapped sectors written since the last Sync back to the
+//  UNIX file; the rest of the mapping is left alone, so the cost is
+//  that of the sectors changed, not of the whole disk.  Nothing needs
+//  to be done when the file is accessed with read/write.
+//----------------------------------------------------------------------
+
+void
+Disk::Sync() {
+    if (mapping != NULL && syncFrom <= syncTo) {
+        SyncMappedFile(mapping, headerSize + syncFrom * SectorSize,
+                       (syncTo - syncFrom + 1) * SectorSize);
+    }
+
+    syncFrom = 1;
+    syncTo = 0;
+}
+
 //----------------------------------------------------------------------
 // Disk::PrintSector()
 //  Dump the data in a disk read/write request, for debugging.
@@ -114,46 +271,99 @@ PrintSector (bool writing, int sector, char* data) {
 
 void
 Disk::ReadRequest(int sectorNumber, char* data) {
-    int ticks = ComputeLatency(sectorNumber, FALSE);
+    ReadRequest(sectorNumber, 1, &data);
+}
 
-    ASSERT(!active);                // only one request at a time
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
+void
+Disk::WriteRequest(int sectorNumber, char* data) {
+    WriteRequest(sectorNumber, 1, &data);
+}
 
-    DEBUG(dbgDisk, "Reading from sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    Read(fileno, data, SectorSize);
+//----------------------------------------------------------------------
+// Disk::ReadRequest/WriteRequest
+//  Simulate a request to read/write a run of consecutive disk sectors,
+//  scattering them into/gathering them from a buffer per sector.  The
+//  head only has to get to the first sector; the others follow it
+//  under the head (see ComputeLatency).  A single interrupt signals
+//  the completion of the whole run.
+//
+//  "sectorNumber" -- the first disk sector to read/write
+//  "numSectors" -- how many sectors
+//  "data" -- a buffer for each sector
+//----------------------------------------------------------------------
 
-    if (debug->IsEnabled('d')) {
-        PrintSector(FALSE, sectorNumber, data);
+void
+Disk::ReadRequest(int sectorNumber, int numSectors, char** data) {
+    int ticks = ComputeLatency(sectorNumber, numSectors, FALSE);
+
+    ASSERT(!active);                // only one request at a time
+    ASSERT((sectorNumber >= 0) && (numSectors > 0)
+           && (sectorNumber + numSectors <= NumSectors));
+
+    DEBUG(dbgDisk, "Reading " << numSectors << " sectors from sector " << sectorNumber);
+    for (int i = 0; i < numSectors; i++) {
+        Transfer(sectorNumber + i, data[i], FALSE);
     }
 
     active = TRUE;
-    UpdateLast(sectorNumber);
+    UpdateLast(sectorNumber + numSectors - 1);
     kernel->stats->numDiskReads++;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
 void
-Disk::WriteRequest(int sectorNumber, char* data) {
-    int ticks = ComputeLatency(sectorNumber, TRUE);
+Disk::WriteRequest(int sectorNumber, int numSectors, char** data) {
+    int ticks = ComputeLatency(sectorNumber, numSectors, TRUE);
 
     ASSERT(!active);
-    ASSERT((sectorNumber >= 0) && (sectorNumber < NumSectors));
-
-    DEBUG(dbgDisk, "Writing to sector " << sectorNumber);
-    Lseek(fileno, SectorSize * sectorNumber + MagicSize, 0);
-    WriteFile(fileno, data, SectorSize);
+    ASSERT((sectorNumber >= 0) && (numSectors > 0)
+           && (sectorNumber + numSectors <= NumSectors));
 
-    if (debug->IsEnabled('d')) {
-        PrintSector(TRUE, sectorNumber, data);
+    DEBUG(dbgDisk, "Writing " << numSectors << " sectors to sector " << sectorNumber);
+    for (int i = 0; i < numSectors; i++) {
+        Transfer(sectorNumber + i, data[i], TRUE);
     }
 
     active = TRUE;
-    UpdateLast(sectorNumber);
+    UpdateLast(sectorNumber + numSectors - 1);
     kernel->stats->numDiskWrites++;
     kernel->interrupt->Schedule(this, ticks, DiskInt);
 }
 
+//----------------------------------------------------------------------
+// Disk::Transfer
+//  Copy a sector between the UNIX file and a buffer.
+//----------------------------------------------------------------------
+
+void
+Disk::Transfer(int sectorNumber, char* data, bool writing) {
+    if (mapping != NULL) {
+        if (writing) {
+            bcopy(data, mapping + headerSize + SectorSize * sectorNumber, SectorSize);
+
+            if (syncFrom > syncTo) {
+                syncFrom = syncTo = sectorNumber;
+            } else {
+                syncFrom = min(syncFrom, sectorNumber);
+                syncTo = max(syncTo, sectorNumber);
+            }
+        } else {
+            bcopy(mapping + headerSize + SectorSize * sectorNumber, data, SectorSize);
+        }
+    } else {
+        Lseek(fileno, SectorSize * sectorNumber + headerSize, 0);
+        if (writing) {
+            WriteFile(fileno, data, SectorSize);
+        } else {
+            Read(fileno, data, SectorSize);
+        }
+    }
+
+    if (debug->IsEnabled('d')) {
+        PrintSector(writing, sectorNumber, data);
+    }
+}
+
 //----------------------------------------------------------------------
 // Disk::CallBack()
 //  Called by the machine simulation when the disk interrupt occurs.
@@ -254,6 +464,39 @@ Disk::ComputeLatency(int newSector, bool writing) {
     return (seek + rotation + RotationTime);
 }
 
+//----------------------------------------------------------------------
+// Disk::ComputeLatency()
+//  Return how long it will take to read/write "numSectors" consecutive
+//  sectors, starting at "newSector".
+//
+//      Getting to the first sector costs what it does for a request
+//      of its own.  When its transfer ends, the head is at the start
+//      of the next sector, so each further sector on the same track
+//      costs just its transfer time.  Moving on to the next track
+//      costs a one-track seek, and the rotational delay until the
+//      wanted sector comes around.
+//----------------------------------------------------------------------
+
+int
+Disk::ComputeLatency(int newSector, int numSectors, bool writing) {
+    int start = kernel->stats->totalTicks;
+    int when = start + ComputeLatency(newSector, writing);  // end of
+    // the first transfer
+
+    for (int sector = newSector + 1; sector < newSector + numSectors; sector++) {
+        if (sector % SectorsPerTrack == 0) {    // next track
+            int over = (when + SeekTime) % RotationTime;
+            int timeAfter = when + SeekTime + ((over > 0) ? RotationTime - over : 0);
+
+            when = timeAfter
+                   + ModuloDiff(sector, timeAfter / RotationTime) * RotationTime;
+        }
+        when += RotationTime;
+    }
+
+    return when - start;
+}
+
 //----------------------------------------------------------------------
 // Disk::UpdateLast
 //      Keep track of the most recently requested sector.  So we can know
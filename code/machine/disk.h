@@ -8,7 +8,10 @@
 //  a file system operation (eg, create a file) is in progress when the
 //  system shuts down, the file system may be corrupted.
 //
-//  DO NOT CHANGE -- part of the machine emulation
+//  Part of the machine emulation.  The disk geometry is not fixed:
+//  it is read from the superblock of the disk image when the disk is
+//  opened (see below), so code must use the variables that hold it
+//  rather than assume their values.
 //
 // Copyright (c) 1992-1993 The Regents of the University of California.
 // All rights reserved.  See copyright.h for copyright notice and limitation
@@ -46,14 +49,33 @@
 // disks these days now come with a track buffer.
 //
 // The track buffer simulation can be disabled by compiling with -DNOTRACKBUF
+//
+// The UNIX file is mapped into memory when the disk is opened, so a
+// sector transfer is a memory copy rather than a seek and a read or
+// write system call.  The mapping is written back to the file by Sync,
+// and when the disk is deleted; only the part holding the sectors
+// written since the last Sync is written back.  Compile with -DNOMMAPDISK (or run on
+// a host where the file can't be mapped) to use read and write instead.
+
+// The geometry of the disk is not fixed at compile time: it is kept in
+// a superblock at the front of the UNIX file, and read back when the
+// disk is opened.  A new disk image gets the geometry asked for on the
+// command line (see Kernel::Kernel), or the defaults below.
+//
+// The variables hold the geometry of the disk that is currently open;
+// they are set by the Disk constructor, and must not be used before.
+
+const int DefaultSectorSize = 128;  // bytes per sector of a new disk
+const int DefaultSectorsPerTrack = 32;  // sectors per track of a new disk
+const int DefaultNumTracks = 32;    // tracks of a new disk
+const int MinSectorSize = 128;      // must hold a file header
+const int MaxSectorSize = 4096;
+const int MaxDiskSize = (1 << 30);  // so every byte offset fits in an int
 
-const int SectorSize = 128;     // number of bytes per disk sector
-// const int SectorsPerTrack  = 1024;    // number of sectors per disk track
-const int SectorsPerTrack  = 32;    // number of sectors per disk track
-// const int NumTracks = 512;       // number of tracks per disk
-const int NumTracks = 32;       // number of tracks per disk
-const int NumSectors = (SectorsPerTrack* NumTracks);
-// total # of sectors per disk
+extern int SectorSize;          // number of bytes per disk sector
+extern int SectorsPerTrack;     // number of sectors per disk track
+extern int NumTracks;           // number of tracks per disk
+extern int NumSectors;          // total # of sectors per disk
 
 class Disk : public CallBackObj {
 public:
@@ -69,16 +91,40 @@ public:
     // Only one request allowed at a time!
     void WriteRequest(int sectorNumber, char* data);
 
+    void ReadRequest(int sectorNumber, int numSectors, char** data);
+    // Read/write "numSectors" consecutive
+    // sectors in one request, each from/to
+    // its own buffer: they cost one seek
+    void WriteRequest(int sectorNumber, int numSectors, char** data);
+
     void CallBack();            // Invoked when disk request
     // finishes. In turn calls, callWhenDone.
 
+    void Sync();            // Make sure every sector written so far
+    // is in the UNIX file
+
     int ComputeLatency(int newSector, bool writing);
     // Return how long a request to
     // newSector will take:
     // (seek + rotational delay + transfer)
+    int ComputeLatency(int newSector, int numSectors, bool writing);
+    // The same, for "numSectors"
+    // consecutive sectors
+
+    int CurrentTrack() {
+        return lastSector / SectorsPerTrack;    // where the head is
+    }
 
 private:
     int fileno;             // UNIX file number for simulated disk
+    int headerSize;         // bytes in front of sector 0: magic
+    // number and superblock
+    char* mapping;          // the UNIX file mapped into memory,
+    // NULL if we use read/write instead
+    int mappingSize;        // bytes mapped
+    int syncFrom, syncTo;       // Sectors written since the last Sync
+    // lie in syncFrom..syncTo; none if
+    // syncFrom > syncTo
     char diskname[32];          // name of simulated disk's file
     CallBackObj* callWhenDone;      // Invoke when any disk request finishes
     bool active;                // Is a disk operation in progress?
@@ -89,6 +135,11 @@ private:
     int TimeToSeek(int newSector, int* rotate); // time to get to the new track
     int ModuloDiff(int to, int from);        // # sectors between to and from
     void UpdateLast(int newSector);
+    void Transfer(int sectorNumber, char* data, bool writing);
+    // Copy one sector from/to the UNIX file
+    void CreateImage(int diskSize, int sectorSize);
+    // Write a fresh superblock and
+    // size the UNIX file to match
 };
 
 #endif // DISK_H
@@ -138,26 +138,60 @@ Interrupt::SetLevel(IntStatus now) {
 }
 
 //----------------------------------------------------------------------
-// Interrupt::OneTick
+// Interrupt::TicksUntilDue
+//  Return the number of ticks of the current mode (user or system)
+//  that can be taken, one at a time, before the one after which the
+//  first pending interrupt is due.  Advancing time by that many ticks
+//  at once fires the interrupt at exactly the time that taking them
+//  one by one would.  Return -1 if no interrupt is pending.
+//
+//  This is always at least one: an interrupt that is already due is
+//  checked for after the next tick.
+//----------------------------------------------------------------------
+
+int
+Interrupt::TicksUntilDue() {
+    int tick = (status == SystemMode) ? SystemTick : UserTick;
+    int until;
+
+    if (pending->IsEmpty()) {
+        return -1;
+    }
+
+    until = pending->Front()->when - kernel->stats->totalTicks;
+
+    if (until <= tick) {
+        return 1;
+    }
+
+    return (until + tick - 1) / tick;
+}
+
+//----------------------------------------------------------------------
+// Interrupt::Advance
 //  Advance simulated time and check if there are any pending
-//  interrupts to be called.
+//  interrupts to be called.  OneTick advances it by one tick.
 //
-//  Two things can cause OneTick to be called:
-//      interrupts are re-enabled
-//      a user instruction is executed
+//  Two things can cause time to be advanced:
+//      interrupts are re-enabled (one tick)
+//      user instructions are executed (one tick each; the
+//          instructions of a basic block are charged together)
+//
+//  "count" is the number of ticks of the current mode (user or
+//  system) to advance by.
 //----------------------------------------------------------------------
 void
-Interrupt::OneTick() {
+Interrupt::Advance(int count) {
     MachineStatus oldStatus = status;
     Statistics* stats = kernel->stats;
 
     // advance simulated time
     if (status == SystemMode) {
-        stats->totalTicks += SystemTick;
-        stats->systemTicks += SystemTick;
+        stats->totalTicks += count * SystemTick;
+        stats->systemTicks += count * SystemTick;
     } else {
-        stats->totalTicks += UserTick;
-        stats->userTicks += UserTick;
+        stats->totalTicks += count * UserTick;
+        stats->userTicks += count * UserTick;
     }
 
     DEBUG(dbgInt, "== Tick " << stats->totalTicks << " ==");
@@ -243,8 +277,6 @@ Interrupt::Halt() {
     cout << "This is halt\n";
     kernel->stats->Print();
     */
-    delete debug;
-
     delete kernel;  // Never returns.
 }
 
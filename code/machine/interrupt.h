@@ -135,7 +135,15 @@ public:
     // at time "when".  This is called
     // by the hardware device simulators.
 
-    void OneTick();         // Advance simulated time
+    void OneTick() {
+        Advance(1);
+    }
+    // Advance simulated time
+    void Advance(int count);    // Advance simulated time by "count"
+    // ticks of the current mode at once
+    int TicksUntilDue();        // How many ticks of the current mode
+    // can pass before an interrupt must be
+    // checked for; -1 if none is pending
 
 private:
     IntStatus level;        // are interrupts enabled or disabled?
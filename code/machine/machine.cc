@@ -50,9 +50,11 @@ void CheckEndian() {
 //
 //  "debug" -- if TRUE, drop into the debugger after each user instruction
 //      is executed.
+//  "tlbEntries" -- the number of entries in the TLB; if 0, there is no
+//      TLB, and translation is done through a linear page table.
 //----------------------------------------------------------------------
 
-Machine::Machine(bool debug) {
+Machine::Machine(bool debug, int tlbEntries) {
     int i;
 
     for (i = 0; i < NumTotalRegs; i++) {
@@ -65,19 +67,36 @@ Machine::Machine(bool debug) {
         mainMemory[i] = 0;
     }
 
-#ifdef USE_TLB
-    tlb = new TranslationEntry[TLBSize];
+    decoded = new Instruction[NumPhysPages * InstrsPerPage];
+    blockLength = new int[NumPhysPages * InstrsPerPage];
+    pageDecoded = new bool[NumPhysPages];
 
-    for (i = 0; i < TLBSize; i++) {
-        tlb[i].valid = FALSE;
+    for (i = 0; i < NumPhysPages; i++) {
+        pageDecoded[i] = FALSE;
+    }
+
+    uncharged = 0;
+    InvalidateTranslations();
+
+    tlbSize = tlbEntries;
+    tlbLookups = 0;
+
+    if (tlbSize > 0) {
+        tlb = new TranslationEntry[tlbSize];
+        tlbLastUse = new int[tlbSize];
+
+        for (i = 0; i < tlbSize; i++) {
+            tlb[i].valid = FALSE;
+            tlbLastUse[i] = 0;
+        }
+    } else {    // use linear page table
+        tlb = NULL;
+        tlbLastUse = NULL;
     }
 
     pageTable = NULL;
-#else   // use linear page table
-    tlb = NULL;
-    pageTable = NULL;
-#endif
 
+    tracing = FALSE;
     singleStep = debug;
     CheckEndian();
 }
@@ -89,9 +108,42 @@ Machine::Machine(bool debug) {
 
 Machine::~Machine() {
     delete [] mainMemory;
+    delete [] decoded;
+    delete [] blockLength;
+    delete [] pageDecoded;
 
     if (tlb != NULL) {
         delete [] tlb;
+        delete [] tlbLastUse;
+    }
+}
+
+//----------------------------------------------------------------------
+// Machine::InvalidateTranslations
+//  Empty the host-pointer cache, because the translations it was
+//  filled from (the page table or TLB) have changed.
+//----------------------------------------------------------------------
+
+void
+Machine::InvalidateTranslations() {
+    for (int i = 0; i < HostCacheSize; i++) {
+        hostCache[i].virtualPage = -1;
+    }
+}
+
+//----------------------------------------------------------------------
+// Machine::InvalidateCode
+//  Throw away the decoded instructions of every page that "size"
+//  bytes of main memory at "physAddr" touch, since they were changed.
+//----------------------------------------------------------------------
+
+void
+Machine::InvalidateCode(int physAddr, int size) {
+    ASSERT(physAddr >= 0 && size >= 0 && physAddr + size <= MemorySize);
+
+    for (int page = physAddr / PageSize;
+            page * PageSize < physAddr + size; page++) {
+        pageDecoded[page] = FALSE;
     }
 }
 
@@ -107,6 +159,16 @@ Machine::~Machine() {
 
 void
 Machine::RaiseException(ExceptionType which, int badVAddr) {
+    // The instructions of the block before this one were run, so time
+    // must have advanced past them before the kernel sees it; this one
+    // is charged for as usual once we return.
+    if (uncharged > 1) {
+        int earlier = uncharged - 1;
+
+        uncharged = 0;
+        kernel->interrupt->Advance(earlier);
+    }
+
     DEBUG(dbgMach, "Exception: " << exceptionNames[which]);
     registers[BadVAddrReg] = badVAddr;
     DelayedLoad(0, 0);          // finish anything in progress
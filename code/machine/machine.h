@@ -39,6 +39,10 @@ const int NumPhysPages = 128;
 
 const int MemorySize = (NumPhysPages* PageSize);
 const int TLBSize = 4;          // if there is a TLB, make it small
+// (this is the default size; see -tlb)
+const int InstrsPerPage = PageSize / 4;     // instructions are 4 bytes
+const int HostCacheSize = 64;   // entries in the host-pointer cache;
+// must be a power of two
 
 enum ExceptionType { NoException,           // Everything ok!
                      SyscallException,      // A program executed a system call.
@@ -88,12 +92,32 @@ enum ExceptionType { NoException,           // Everything ok!
 // The procedures in this class are defined in machine.cc, mipssim.cc, and
 // translate.cc.
 
-class Instruction;
 class Interrupt;
 
+// The following class defines an instruction, represented in both
+//  undecoded binary form
+//      decoded to identify
+//      operation to do
+//      registers to act on
+//      any immediate operand value
+
+class Instruction {
+public:
+    void Decode();  // decode the binary representation of the instruction
+
+    unsigned int value; // binary representation of the instruction
+
+    int opCode;     // Type of instruction.  This is NOT the same as the
+    // opcode field from the instruction: see defs in mips.h
+    int rs, rt, rd; // Three registers from instruction.
+    int extra;       // Immediate or target or shamt field or offset.
+    // Immediates are sign-extended.
+};
+
 class Machine {
 public:
-    Machine(bool debug);    // Initialize the simulation of the hardware
+    Machine(bool debug, int tlbEntries);
+    // Initialize the simulation of the hardware
     // for running user programs
     ~Machine();         // De-allocate the data structures
 
@@ -134,6 +158,11 @@ public:
 
     TranslationEntry* tlb;      // this pointer should be considered
     // "read-only" to Nachos kernel code
+    int tlbSize;                // entries in the TLB, 0 if none
+    int* tlbLastUse;            // for each TLB entry, when it was last
+    // used, counted in TLB lookups; not real
+    // hardware, but lets the kernel replace
+    // the least recently used entry
 
     TranslationEntry* pageTable;
     unsigned int pageTableSize;
@@ -143,16 +172,46 @@ public:
     // Read or write 1, 2, or 4 bytes of virtual
     // memory (at addr).  Return FALSE if a
     // correct translation couldn't be found.
+
+    void InvalidateTranslations();
+    // Called whenever the page table or
+    // TLB is changed, so that accesses
+    // stop using the old translations
+
+    void InvalidateCode(int physAddr, int size);
+    // Called when "size" bytes of main
+    // memory at "physAddr" are modified
+    // other than by WriteMem (for instance
+    // when a program is loaded), so that
+    // stale decoded instructions are not
+    // run
 private:
 
     // Routines internal to the machine simulation -- DO NOT call these directly
     void DelayedLoad(int nextReg, int nextVal);
     // Do a pending delayed load (modifying a reg)
 
-    void OneInstruction(Instruction* instr);
+    void OneInstruction();
     // Run one instruction of a user program.
 
+    void RunBlock(int limit);
+    // Run the basic block at the PC, but no
+    // more than "limit" instructions of it
+    // (if not -1), and charge for them
+
+    void Execute(Instruction* instr);
+    // Run "instr", the instruction at the PC
 
+    Instruction* FetchDecoded(int physAddr);
+    // Return the instruction at "physAddr",
+    // decoded
+
+
+    char* HostAddress(int virtAddr, int size, bool writing);
+    // Where "virtAddr" is in mainMemory,
+    // if the host-pointer cache can
+    // tell; NULL if Translate must be
+    // used
 
     ExceptionType Translate(int virtAddr, int* physAddr, int size, bool writing);
     // Translate an address, and check for
@@ -173,6 +232,26 @@ private:
 
     int registers[NumTotalRegs]; // CPU registers, for executing user programs
 
+    // Decoded-instruction cache: every word of a physical page decoded
+    // as an instruction, the first time code is fetched from the page.
+    // A write to the page throws the whole page away.
+    Instruction* decoded;       // InstrsPerPage per physical page
+    int* blockLength;           // For each of those, the length of the
+    // basic block starting there
+    bool* pageDecoded;          // Is the page's part of "decoded" valid?
+
+    // Host-pointer cache: direct mapped by virtual page number, filled
+    // by every successful Translate.
+    HostTranslation hostCache[HostCacheSize];
+
+    int tlbLookups;             // TLB lookups so far, for "tlbLastUse"
+
+    int uncharged;              // Instructions RunBlock has run and not
+    // charged for, counting the one running
+
+    bool tracing;               // print each instruction executed
+    // (debug flag 'm'), looked up once in Run
+
     bool singleStep;        // drop back into the debugger after each
     // simulated instruction
     int runUntilTime;       // drop back into the debugger when simulated
@@ -24,56 +24,155 @@
 
 static void Mult(int a, int b, bool signedArith, int* hiPtr, int* loPtr);
 
-// The following class defines an instruction, represented in both
-//  undecoded binary form
-//      decoded to identify
-//      operation to do
-//      registers to act on
-//      any immediate operand value
-
-class Instruction {
-public:
-    void Decode();  // decode the binary representation of the instruction
-
-    unsigned int value; // binary representation of the instruction
-
-    int opCode;     // Type of instruction.  This is NOT the same as the
-    // opcode field from the instruction: see defs in mips.h
-    int rs, rt, rd; // Three registers from instruction.
-    int extra;       // Immediate or target or shamt field or offset.
-    // Immediates are sign-extended.
-};
-
 //----------------------------------------------------------------------
 // Machine::Run
 //  Simulate the execution of a user-level program on Nachos.
 //  Called by the kernel when the program starts up; never returns.
 //
+//  Unless we are single-stepping, the program is run a basic block
+//  at a time (see RunBlock), and simulated time is advanced once per
+//  block, by the number of instructions it executed.  A block is cut
+//  short where the next pending interrupt falls due, so interrupts
+//  happen at the same time as if we checked after every instruction.
+//
 //  This routine is re-entrant, in that it can be called multiple
 //  times concurrently -- one for each thread executing user code.
 //----------------------------------------------------------------------
 
 void
 Machine::Run() {
-    Instruction* instr = new Instruction;  // storage for decoded instruction
-
     if (debug->IsEnabled('m')) {
         cout << "Starting program in thread: " << kernel->currentThread->getName();
         cout << ", at time: " << kernel->stats->totalTicks << "\n";
     }
 
     kernel->interrupt->setStatus(UserMode);
+    tracing = debug->IsEnabled('m');
 
     for (;;) {
-        OneInstruction(instr);
+        if (!singleStep) {
+            RunBlock(kernel->interrupt->TicksUntilDue());
+            continue;
+        }
+
+        OneInstruction();
         kernel->interrupt->OneTick();
 
-        if (singleStep && (runUntilTime <= kernel->stats->totalTicks)) {
+        if (runUntilTime <= kernel->stats->totalTicks) {
             Debugger();
         }
     }
 }
 
+//----------------------------------------------------------------------
+// StopsBlock, EndsWithDelaySlot
+//  Classify a decoded instruction for basic-block discovery.
+//  An instruction that always traps (syscall, illegal instruction)
+//  is a block of its own, so that everything before it has been
+//  charged for when the kernel is entered; a branch or jump ends its
+//  block after its delay slot.
+//----------------------------------------------------------------------
+
+static bool
+StopsBlock(int opCode) {
+    switch (opCode) {
+        case OP_SYSCALL:
+        case OP_RES:
+        case OP_UNIMP:
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+static bool
+EndsWithDelaySlot(int opCode) {
+    switch (opCode) {
+        case OP_BEQ:
+        case OP_BGEZ:
+        case OP_BGEZAL:
+        case OP_BGTZ:
+        case OP_BLEZ:
+        case OP_BLTZ:
+        case OP_BLTZAL:
+        case OP_BNE:
+        case OP_J:
+        case OP_JAL:
+        case OP_JALR:
+        case OP_JR:
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+//----------------------------------------------------------------------
+// Machine::RunBlock
+//  Execute the basic block starting at the PC, but no more than
+//  "limit" instructions of it unless "limit" is -1, then advance
+//  simulated time by the number of instructions executed.
+//
+//  The block was found when its page was decoded: a run of decoded
+//  instructions in one page, so the PC is translated once for all of
+//  them.  We stop early if an instruction does not fall through to
+//  the next one -- it trapped, or it is the delay slot of a taken
+//  branch -- or if the page was written (self-modifying code), in
+//  which case the rest of the block must be decoded again.
+//
+//  An instruction that traps has RaiseException charge for the ones
+//  before it (see "uncharged"), so that is left to do for it alone.
+//----------------------------------------------------------------------
+
+void
+Machine::RunBlock(int limit) {
+    int pc = registers[PCReg];
+    int physAddr;
+    ExceptionType exception = Translate(pc, &physAddr, 4, FALSE);
+
+    if (exception != NoException) {
+        RaiseException(exception, pc);
+        kernel->interrupt->OneTick();
+        return;
+    }
+
+    Instruction* instr = FetchDecoded(physAddr);
+    int length = blockLength[physAddr / 4];
+    int page = physAddr / PageSize;
+    int count = 0;
+
+    if (limit != -1 && limit < length) {
+        length = limit;
+    }
+
+    // With a TLB, each instruction fetch must be looked up in it, as
+    // on the real machine, so we go one instruction at a time.
+    if (tlb != NULL) {
+        length = 1;
+    }
+
+    while (count < length) {
+        uncharged = count + 1;
+        Execute(&instr[count]);
+        count++;
+        pc += 4;
+
+        if (registers[PCReg] != pc || !pageDecoded[page]) {
+            break;
+        }
+    }
+
+    // if a trap charged for the earlier instructions, only the one
+    // that trapped is left
+    if (uncharged == 0) {
+        count = 1;
+    }
+
+    uncharged = 0;
+    kernel->interrupt->Advance(count);
+}
+
 
 //----------------------------------------------------------------------
 // TypeToReg
@@ -103,6 +202,26 @@ TypeToReg(RegType reg, Instruction* instr) {
 //----------------------------------------------------------------------
 // Machine::OneInstruction
 //  Execute one instruction from a user-level program
+//----------------------------------------------------------------------
+
+void
+Machine::OneInstruction() {
+    int physAddr;
+
+    // Fetch instruction
+    ExceptionType exception = Translate(registers[PCReg], &physAddr, 4, FALSE);
+
+    if (exception != NoException) {
+        RaiseException(exception, registers[PCReg]);
+        return;    // exception occurred
+    }
+
+    Execute(FetchDecoded(physAddr));
+}
+
+//----------------------------------------------------------------------
+// Machine::Execute
+//  Execute the decoded instruction "instr", which is the one at the PC.
 //
 //  If there is any kind of exception or interrupt, we invoke the
 //  exception handler, and when it returns, we return to Run(), which
@@ -120,29 +239,22 @@ TypeToReg(RegType reg, Instruction* instr) {
 //  store all data back to the machine registers and memory before
 //  leaving.  This allows the Nachos kernel to control our behavior
 //  by controlling the contents of memory, the translation table,
-//  and the register set.
+//  and the register set.  The one exception is the decoded form of
+//  the instructions, which is cached per physical page (see
+//  FetchDecoded), and thrown away whenever the page is written.
 //----------------------------------------------------------------------
 
 void
-Machine::OneInstruction(Instruction* instr) {
+Machine::Execute(Instruction* instr) {
 #ifdef SIM_FIX
     int byte;       // described in Kane for LWL,LWR,...
 #endif
 
-    int raw;
     int nextLoadReg = 0;
     int nextLoadValue = 0;  // record delayed load operation, to apply
     // in the future
 
-    // Fetch instruction
-    if (!ReadMem(registers[PCReg], 4, &raw)) {
-        return;    // exception occurred
-    }
-
-    instr->value = raw;
-    instr->Decode();
-
-    if (debug->IsEnabled('m')) {
+    if (tracing) {
         struct OpString* str = &opStrings[instr->opCode];
         char buf[80];
 
@@ -814,6 +926,53 @@ Machine::OneInstruction(Instruction* instr) {
     registers[NextPCReg] = pcAfter;
 }
 
+//----------------------------------------------------------------------
+// Machine::FetchDecoded
+//  Return the decoded form of the instruction at physical address
+//  "physAddr".  The first fetch from a page decodes every word of it,
+//  and finds the basic block starting at each one (see RunBlock);
+//  later fetches from the page are just an index, until the page is
+//  written (see InvalidateCode).
+//----------------------------------------------------------------------
+
+Instruction*
+Machine::FetchDecoded(int physAddr) {
+    int page = physAddr / PageSize;
+    Instruction* instrs = &decoded[page * InstrsPerPage];
+
+    if (!pageDecoded[page]) {
+        unsigned int* words = (unsigned int*) &mainMemory[page * PageSize];
+
+        int* lengths = &blockLength[page * InstrsPerPage];
+
+        for (int i = 0; i < InstrsPerPage; i++) {
+            instrs[i].value = WordToHost(words[i]);
+            instrs[i].Decode();
+        }
+
+        // Working backwards, a block runs to the end of the page, up
+        // to (but not including) a trapping instruction, or through
+        // the delay slot of a branch.
+        for (int i = InstrsPerPage - 1; i >= 0; i--) {
+            bool last = (i == InstrsPerPage - 1);
+
+            if (StopsBlock(instrs[i].opCode)) {
+                lengths[i] = 1;
+            } else if (EndsWithDelaySlot(instrs[i].opCode)) {
+                lengths[i] = last ? 1 : 2;
+            } else if (last || StopsBlock(instrs[i + 1].opCode)) {
+                lengths[i] = 1;
+            } else {
+                lengths[i] = 1 + lengths[i + 1];
+            }
+        }
+
+        pageDecoded[page] = TRUE;
+    }
+
+    return &instrs[(physAddr % PageSize) / 4];
+}
+
 //----------------------------------------------------------------------
 // Machine::DelayedLoad
 //  Simulate effects of a delayed load.
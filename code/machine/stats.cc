@@ -19,8 +19,17 @@
 Statistics::Statistics() {
     totalTicks = idleTicks = systemTicks = userTicks = 0;
     numDiskReads = numDiskWrites = 0;
+    numCacheHits = numCacheMisses = numCacheEvictions = 0;
+    numPrefetches = 0;
+    diskScheduler = "none";
+    numDiskRequests = 0;
+    diskLatency = diskSeekTracks = 0;
+    numJournalCommits = numJournalSectors = 0;
     numConsoleCharsRead = numConsoleCharsWritten = 0;
     numPageFaults = numPacketsSent = numPacketsRecvd = 0;
+    numTLBHits = numTLBMisses = 0;
+    tlbPolicy = "none";
+    tlbEntries = 0;
 }
 
 //----------------------------------------------------------------------
@@ -35,9 +44,30 @@ Statistics::Print() {
     cout << ", system " << systemTicks << ", user " << userTicks << "\n";
     cout << "Disk I/O: reads " << numDiskReads;
     cout << ", writes " << numDiskWrites << "\n";
+    cout << "Disk cache: hits " << numCacheHits;
+    cout << ", misses " << numCacheMisses;
+    cout << ", evictions " << numCacheEvictions;
+    cout << ", prefetches " << numPrefetches << "\n";
+    if (numDiskRequests > 0) {
+        cout << "Disk scheduling (" << diskScheduler << "): requests ";
+        cout << numDiskRequests;
+        cout << ", average latency " << diskLatency / numDiskRequests;
+        cout << ", average seek " << (double) diskSeekTracks / numDiskRequests;
+        cout << " tracks\n";
+    }
+    if (numJournalCommits > 0) {
+        cout << "Journal: commits " << numJournalCommits;
+        cout << ", sectors logged " << numJournalSectors << "\n";
+    }
     cout << "Console I/O: reads " << numConsoleCharsRead;
     cout << ", writes " << numConsoleCharsWritten << "\n";
     cout << "Paging: faults " << numPageFaults << "\n";
+    if (numTLBHits + numTLBMisses > 0) {
+        cout << "TLB (" << tlbPolicy << ", " << tlbEntries << " entries): ";
+        cout << "hits " << numTLBHits << ", misses " << numTLBMisses;
+        cout << ", hit ratio ";
+        cout << (double) numTLBHits / (numTLBHits + numTLBMisses) << "\n";
+    }
     cout << "Network I/O: packets received " << numPacketsRecvd;
     cout << ", sent " << numPacketsSent << "\n";
 }
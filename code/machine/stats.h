@@ -30,9 +30,27 @@ public:
 
     int numDiskReads;       // number of disk read requests
     int numDiskWrites;      // number of disk write requests
+    int numCacheHits;       // number of sector requests found in
+    // the SynchDisk sector cache
+    int numCacheMisses;     // number of sector requests not in the cache
+    int numCacheEvictions;  // number of cached sectors replaced
+    int numPrefetches;      // number of sectors read ahead of need
+    const char* diskScheduler;  // disk scheduling policy in use
+    int numDiskRequests;    // number of requests served by the
+    // disk scheduler
+    long long diskLatency;  // total ticks from queueing a disk
+    // request to its completion
+    long long diskSeekTracks;   // total tracks the disk head moved
+    int numJournalCommits;  // number of metadata journal commits
+    int numJournalSectors;  // sectors written to the journal log
     int numConsoleCharsRead;    // number of characters read from the keyboard
     int numConsoleCharsWritten; // number of characters written to the display
     int numPageFaults;      // number of virtual memory page faults
+    int numTLBHits;         // number of translations found in the TLB
+    int numTLBMisses;       // number of TLB misses (refilled by the
+    // kernel)
+    const char* tlbPolicy;  // TLB replacement policy in use
+    int tlbEntries;         // entries in the TLB
     int numPacketsSent;     // number of packets sent over the network
     int numPacketsRecvd;    // number of packets received over the network
 
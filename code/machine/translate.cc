@@ -94,26 +94,32 @@ Machine::ReadMem(int addr, int size, int* value) {
 
     DEBUG(dbgAddr, "Reading VA " << addr << ", size " << size);
 
-    exception = Translate(addr, &physicalAddress, size, FALSE);
+    char* host = HostAddress(addr, size, FALSE);
 
-    if (exception != NoException) {
-        RaiseException(exception, addr);
-        return FALSE;
+    if (host == NULL) {
+        exception = Translate(addr, &physicalAddress, size, FALSE);
+
+        if (exception != NoException) {
+            RaiseException(exception, addr);
+            return FALSE;
+        }
+
+        host = &mainMemory[physicalAddress];
     }
 
     switch (size) {
         case 1:
-            data = mainMemory[physicalAddress];
+            data = *host;
             *value = data;
             break;
 
         case 2:
-            data = *(unsigned short*) &mainMemory[physicalAddress];
+            data = *(unsigned short*) host;
             *value = ShortToHost(data);
             break;
 
         case 4:
-            data = *(unsigned int*) &mainMemory[physicalAddress];
+            data = *(unsigned int*) host;
             *value = WordToHost(data);
             break;
 
@@ -145,25 +151,31 @@ Machine::WriteMem(int addr, int size, int value) {
 
     DEBUG(dbgAddr, "Writing VA " << addr << ", size " << size << ", value " << value);
 
-    exception = Translate(addr, &physicalAddress, size, TRUE);
+    char* host = HostAddress(addr, size, TRUE);
+
+    if (host == NULL) {
+        exception = Translate(addr, &physicalAddress, size, TRUE);
+
+        if (exception != NoException) {
+            RaiseException(exception, addr);
+            return FALSE;
+        }
 
-    if (exception != NoException) {
-        RaiseException(exception, addr);
-        return FALSE;
+        host = &mainMemory[physicalAddress];
     }
 
     switch (size) {
         case 1:
-            mainMemory[physicalAddress] = (unsigned char) (value & 0xff);
+            *host = (unsigned char) (value & 0xff);
             break;
 
         case 2:
-            *(unsigned short*) &mainMemory[physicalAddress]
+            *(unsigned short*) host
                 = ShortToMachine((unsigned short) (value & 0xffff));
             break;
 
         case 4:
-            *(unsigned int*) &mainMemory[physicalAddress]
+            *(unsigned int*) host
                 = WordToMachine((unsigned int) value);
             break;
 
@@ -171,9 +183,39 @@ Machine::WriteMem(int addr, int size, int value) {
             ASSERT(FALSE);
     }
 
+    // the write may have been to code (a size-byte write never
+    // crosses a page boundary)
+    pageDecoded[(host - mainMemory) / PageSize] = FALSE;
     return TRUE;
 }
 
+//----------------------------------------------------------------------
+// Machine::HostAddress
+//  Look up virtual address "virtAddr" in the host-pointer cache, for
+//  an access of "size" bytes.  Return where the address is in
+//  mainMemory, or NULL if the cache cannot say so: the page is not
+//  cached, the address is not aligned, or this is a store to a page
+//  that stores must still be translated for.  The caller then goes
+//  through Translate, which raises any exception and refills the
+//  cache.
+//
+//  On a hit, this is all the translation there is: a mask, a compare,
+//  and a pointer add.
+//----------------------------------------------------------------------
+
+char*
+Machine::HostAddress(int virtAddr, int size, bool writing) {
+    int vpn = (unsigned) virtAddr / PageSize;
+    HostTranslation* cached = &hostCache[vpn & (HostCacheSize - 1)];
+
+    if (cached->virtualPage != vpn || (virtAddr & (size - 1)) != 0
+            || (writing && !cached->writable)) {
+        return NULL;
+    }
+
+    return cached->memory + (unsigned) virtAddr % PageSize;
+}
+
 //----------------------------------------------------------------------
 // Machine::Translate
 //  Translate a virtual address into a physical address, using
@@ -224,18 +266,22 @@ Machine::Translate(int virtAddr, int* physAddr, int size, bool writing) {
 
         entry = &pageTable[vpn];
     } else {
-        for (entry = NULL, i = 0; i < TLBSize; i++)
+        for (entry = NULL, i = 0; i < tlbSize; i++)
             if (tlb[i].valid && (tlb[i].virtualPage == ((int)vpn))) {
                 entry = &tlb[i];            // FOUND!
+                tlbLastUse[i] = ++tlbLookups;
                 break;
             }
 
         if (entry == NULL) {                // not found
             DEBUG(dbgAddr, "Invalid TLB entry for this virtual page!");
+            kernel->stats->numTLBMisses++;
             return PageFaultException;      // really, this is a TLB fault,
             // the page may be in memory,
             // but not in the TLB
         }
+
+        kernel->stats->numTLBHits++;
     }
 
     if (entry->readOnly && writing) {   // trying to write to a read-only page
@@ -260,6 +306,19 @@ Machine::Translate(int virtAddr, int* physAddr, int size, bool writing) {
 
     *physAddr = pageFrame * PageSize + offset;
     ASSERT((*physAddr >= 0) && ((*physAddr + size) <= MemorySize));
+
+    // Remember the page, so that HostAddress can find it next time.
+    // The use bit is set by now; the dirty bit may not be, in which
+    // case stores must come back here to set it.  Not with a TLB,
+    // whose every lookup is counted (and whose hit and miss counts
+    // are what it is there to measure).
+    if (tlb == NULL) {
+        HostTranslation* cached = &hostCache[vpn & (HostCacheSize - 1)];
+        cached->virtualPage = vpn;
+        cached->memory = &mainMemory[pageFrame * PageSize];
+        cached->writable = entry->dirty && !entry->readOnly;
+    }
+
     DEBUG(dbgAddr, "phys addr = " << *physAddr);
     return NoException;
 }
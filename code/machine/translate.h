@@ -42,4 +42,19 @@ public:
     // page is modified.
 };
 
+// The following class defines an entry in the machine's host-pointer
+// cache, which remembers where in "mainMemory" a recently translated
+// virtual page is, so that loads and stores to it need not go through
+// the page table or TLB again.  This is part of the simulation, not
+// of the simulated hardware: the kernel never sees it.
+
+class HostTranslation {
+public:
+    int virtualPage;    // The page cached, or -1 if none
+    char* memory;       // Where the page starts, in "mainMemory"
+    bool writable;      // May stores bypass Translate too?  Only if
+    // the page is writable, and its dirty bit
+    // already set.
+};
+
 #endif
@@ -17,6 +17,28 @@
 #include "synchdisk.h"
 #include "post.h"
 #include "synchconsole.h"
+#include "tlbmanager.h"
+
+//----------------------------------------------------------------------
+// ParseSize
+//  Convert a size given on the command line into a number of bytes;
+//  a "K" or "M" suffix multiplies it by 1024 or 1024*1024.
+//----------------------------------------------------------------------
+
+static int
+ParseSize(char* arg) {
+    char* end;
+    long size = strtol(arg, &end, 10);
+
+    if (*end == 'K' || *end == 'k') {
+        size *= 1024;
+    } else if (*end == 'M' || *end == 'm') {
+        size *= 1024 * 1024;
+    }
+
+    ASSERT(size > 0 && size <= MaxDiskSize);
+    return (int) size;
+}
 
 //----------------------------------------------------------------------
 // Kernel::Kernel
@@ -29,12 +51,19 @@ Kernel::Kernel(int argc, char** argv) {
     debugUserProg = FALSE;
     consoleIn = NULL;          // default is stdin
     consoleOut = NULL;         // default is stdout
-#ifndef FILESYS_STUB
     formatFlag = FALSE;
-#endif
     reliability = 1;            // network reliability, default is 1.0
     hostName = 0;               // machine id, also UNIX socket name
     // 0 is the default machine id
+    diskSize = 0;               // keep the disk image we find
+    diskSectorSize = 0;
+    diskScheduler = NULL;       // default is C-LOOK
+#ifdef USE_TLB
+    tlbSize = TLBSize;          // default is a TLB of TLBSize entries
+#else
+    tlbSize = 0;                // default is linear page tables
+#endif
+    tlbPolicy = NULL;           // default is LRU
 
     // MP4 mod tag
     execfileNum = 0; // dummy operation to keep valgrind happy
@@ -62,7 +91,32 @@ Kernel::Kernel(int argc, char** argv) {
 #ifndef FILESYS_STUB
         } else if (strcmp(argv[i], "-f") == 0) {
             formatFlag = TRUE;
+        } else if (strcmp(argv[i], "-fsize") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is a size
+            diskSize = ParseSize(argv[i + 1]);
+            formatFlag = TRUE;      // a new disk has to be formatted
+            i++;
+        } else if (strcmp(argv[i], "-fsector") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is a size
+            diskSectorSize = ParseSize(argv[i + 1]);
+            formatFlag = TRUE;
+            i++;
 #endif
+        } else if (strcmp(argv[i], "-dsched") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is a policy name
+            diskScheduler = argv[i + 1];
+            i++;
+        } else if (strcmp(argv[i], "-tlb") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is a size
+            tlbSize = atoi(argv[i + 1]);
+            // an instruction may need two pages at once: its own,
+            // and the one it loads or stores
+            ASSERT(tlbSize == 0 || tlbSize >= 2);
+            i++;
+        } else if (strcmp(argv[i], "-tlbrepl") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is a policy name
+            tlbPolicy = argv[i + 1];
+            i++;
         } else if (strcmp(argv[i], "-n") == 0) {
             ASSERT(i + 1 < argc);   // next argument is float
             reliability = atof(argv[i + 1]);
@@ -77,7 +131,10 @@ Kernel::Kernel(int argc, char** argv) {
             cout << "Partial usage: nachos [-ci consoleIn] [-co consoleOut]\n";
 #ifndef FILESYS_STUB
             cout << "Partial usage: nachos [-nf]\n";
+            cout << "Partial usage: nachos [-f] [-fsize #[K|M]] [-fsector #]\n";
 #endif
+            cout << "Partial usage: nachos [-dsched fcfs|sstf|scan|clook]\n";
+            cout << "Partial usage: nachos [-tlb #] [-tlbrepl fifo|random|lru]\n";
             cout << "Partial usage: nachos [-n #] [-m #]\n";
         }
     }
@@ -104,7 +161,12 @@ Kernel::Initialize() {
     interrupt = new Interrupt;      // start up interrupt handling
     scheduler = new Scheduler();    // initialize the ready queue
     alarm = new Alarm(randomSlice); // start up time slicing
-    machine = new Machine(debugUserProg);
+    machine = new Machine(debugUserProg, tlbSize);
+    if (tlbSize > 0) {
+        tlbManager = new TLBManager(tlbPolicy);
+    } else {
+        tlbManager = NULL;
+    }
     synchConsoleIn = new SynchConsoleInput(consoleIn); // input from stdin
     synchConsoleOut = new SynchConsoleOutput(consoleOut); // output to stdout
     synchDisk = new SynchDisk();    //
@@ -142,15 +204,18 @@ Kernel::PrepareToEnd() {
 //----------------------------------------------------------------------
 
 Kernel::~Kernel() {
+    // the file system and disk go first: flushing the disk cache
+    // still needs interrupts, the scheduler and the statistics
+    delete fileSystem;
+    delete synchDisk;
     delete stats;
     delete interrupt;
     delete scheduler;
     delete alarm;
+    delete tlbManager;
     delete machine;
     delete synchConsoleIn;
     delete synchConsoleOut;
-    delete synchDisk;
-    delete fileSystem;
 
     // Mp4 mod tag
     /*
@@ -158,6 +223,7 @@ Kernel::~Kernel() {
     delete postOfficeOut;
     */
 
+    delete debug;
     Exit(0);
 }
 
@@ -333,20 +399,52 @@ int Kernel::CreateFile(char* filename, int initialSize) {
     return fileSystem->Create(filename, initialSize);
 }
 
+//----------------------------------------------------------------------
+// Kernel::Open, Kernel::Write, Kernel::Read, Kernel::Close
+//  The file system calls.  File descriptors belong to the address
+//  space of the calling program (see fdtable.h); Open returns -1,
+//  and the others -1 (Close: 0) for a descriptor that is not open.
+//----------------------------------------------------------------------
+
 int Kernel::Open(char* filename) {
-    return fileSystem->Open(filename, 0);
+    OpenFile* file = fileSystem->Open(filename);
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    return currentThread->space->openFiles->Add(file);
 }
 
 int Kernel::Write(char* buffer, int size, int id) {
-    return fileSystem->Write(buffer, size, id);
+    OpenFile* file = currentThread->space->openFiles->Get(id);
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    return file->Write(buffer, size);
 }
 
 int Kernel::Read(char* buffer, int size, int id) {
-    return fileSystem->Read(buffer, size, id);
+    OpenFile* file = currentThread->space->openFiles->Get(id);
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    return file->Read(buffer, size);
 }
 
 int Kernel::Close(int id) {
-    return fileSystem->Close(id);
+    OpenFile* file = currentThread->space->openFiles->Remove(id);
+
+    if (file == NULL) {
+        return 0;
+    }
+
+    delete file;
+    return 1;
 }
 
 void Kernel::PrintChar(char c) {
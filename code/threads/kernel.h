@@ -24,6 +24,7 @@ class PostOfficeOutput;
 class SynchConsoleInput;
 class SynchConsoleOutput;
 class SynchDisk;
+class TLBManager;
 
 
 
@@ -66,6 +67,8 @@ public:
     Statistics* stats;      // performance metrics
     Alarm* alarm;       // the software alarm clock
     Machine* machine;           // the simulated CPU
+    TLBManager* tlbManager;     // TLB miss handling, NULL if the
+    // machine has no TLB
     SynchConsoleInput* synchConsoleIn;
     SynchConsoleOutput* synchConsoleOut;
     SynchDisk* synchDisk;
@@ -74,6 +77,17 @@ public:
     PostOfficeOutput* postOfficeOut;
 
     int hostName;               // machine identifier
+    bool formatFlag;            // format the disk if this is true
+    int diskSize;               // bytes on a new disk image,
+    // 0 to keep the existing one
+    int diskSectorSize;         // bytes per sector of a new disk
+    // image, 0 for the default
+    char* diskScheduler;        // disk scheduling policy, NULL
+    // for the default
+    int tlbSize;                // entries in the TLB, 0 to translate
+    // through page tables
+    char* tlbPolicy;            // TLB replacement policy, NULL for
+    // the default
 
 private:
 
@@ -86,9 +100,6 @@ private:
     double reliability;         // likelihood messages are dropped
     char* consoleIn;            // file to read console input from
     char* consoleOut;           // file to send console output to
-#ifndef FILESYS_STUB
-    bool formatFlag;          // format the disk if this is true
-#endif
 };
 
 
@@ -4,9 +4,11 @@
 //
 // Usage: nachos -d <debugflags> -rs <random seed #>
 //              -s -x <nachos file> -ci <consoleIn> -co <consoleOut>
-//              -f -cp <unix file> <nachos file>
+//              -f -fsize <bytes> -fsector <bytes>
+//              -cp <unix file> <nachos file>
 //              -p <nachos file> -r <nachos file> -l -D
 //              -n <network reliability> -m <machine id>
+//              -tlb <entries> -tlbrepl <policy>
 //              -z -K -C -N
 //
 //    -d causes certain debugging messages to be printed (see debug.h)
@@ -18,12 +20,19 @@
 //    -co specify file for console output (stdout is the default)
 //    -n sets the network reliability
 //    -m sets this machine's host id (needed for the network)
+//    -dsched sets the disk scheduling policy: fcfs, sstf, scan or clook
+//    -tlb runs user programs with a software-loaded TLB of the given
+//       number of entries (at least 2), instead of page tables
+//    -tlbrepl sets the TLB replacement policy: fifo, random or lru
 //    -K run a simple self test of kernel threads and synchronization
 //    -C run an interactive console test
 //    -N run a two-machine network test (see Kernel::NetworkTest)
 //
 //    Filesystem-related flags:
 //    -f forces the Nachos disk to be formatted
+//    -fsize, -fsector create a new disk image of the given size (a
+//       number of bytes, or with a K or M suffix) and sector size,
+//       and format it
 //    -cp copies a file from UNIX to Nachos
 //    -p prints a Nachos file to stdout
 //    -r removes a Nachos file from the file system
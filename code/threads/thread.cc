@@ -68,6 +68,8 @@ Thread::~Thread() {
     if (stack != NULL) {
         DeallocBoundedArray((char*) stack, StackSize * sizeof(int));
     }
+
+    delete space;
 }
 
 //----------------------------------------------------------------------
@@ -163,11 +165,19 @@ Thread::Begin () {
 //
 //  NOTE: we disable interrupts, because Sleep() assumes interrupts
 //  are disabled.
+//
+//  The files a user program left open are closed here, before that:
+//  closing a file may have to wait for the disk, which the destructor,
+//  called from inside the scheduler, cannot do.
 //----------------------------------------------------------------------
 
 //
 void
 Thread::Finish () {
+    if (space != NULL) {
+        space->openFiles->CloseAll();
+    }
+
     (void) kernel->interrupt->SetLevel(IntOff);
     ASSERT(this == kernel->currentThread);
 
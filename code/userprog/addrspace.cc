@@ -20,6 +20,7 @@
 #include "addrspace.h"
 #include "machine.h"
 #include "noff.h"
+#include "tlbmanager.h"
 
 //----------------------------------------------------------------------
 // SwapHeader
@@ -78,15 +79,20 @@ AddrSpace::AddrSpace() {
 
     // zero out the entire address space
     bzero(kernel->machine->mainMemory, MemorySize);
+    kernel->machine->InvalidateCode(0, MemorySize);
+
+    openFiles = new FileDescriptorTable;
 }
 
 //----------------------------------------------------------------------
 // AddrSpace::~AddrSpace
-//  Dealloate an address space.
+//  Dealloate an address space.  The files the program left open were
+//  closed when its thread finished.
 //----------------------------------------------------------------------
 
 AddrSpace::~AddrSpace() {
     delete pageTable;
+    delete openFiles;
 }
 
 
@@ -150,6 +156,8 @@ AddrSpace::Load(char* fileName) {
         executable->ReadAt(
             &(kernel->machine->mainMemory[noffH.code.virtualAddr]),
             noffH.code.size, noffH.code.inFileAddr);
+        kernel->machine->InvalidateCode(noffH.code.virtualAddr,
+                                        noffH.code.size);
     }
 
     if (noffH.initData.size > 0) {
@@ -158,6 +166,8 @@ AddrSpace::Load(char* fileName) {
         executable->ReadAt(
             &(kernel->machine->mainMemory[noffH.initData.virtualAddr]),
             noffH.initData.size, noffH.initData.inFileAddr);
+        kernel->machine->InvalidateCode(noffH.initData.virtualAddr,
+                                        noffH.initData.size);
     }
 
 #ifdef RDATA
@@ -168,6 +178,8 @@ AddrSpace::Load(char* fileName) {
         executable->ReadAt(
             &(kernel->machine->mainMemory[noffH.readonlyData.virtualAddr]),
             noffH.readonlyData.size, noffH.readonlyData.inFileAddr);
+        kernel->machine->InvalidateCode(noffH.readonlyData.virtualAddr,
+                                        noffH.readonlyData.size);
     }
 
 #endif
@@ -242,10 +254,14 @@ AddrSpace::InitRegisters() {
 //  On a context switch, save any machine state, specific
 //  to this address space, that needs saving.
 //
-//  For now, don't need to save anything!
+//  For now, that is only the TLB, if there is one: its entries belong
+//  to this address space, so they are written back and dropped.
 //----------------------------------------------------------------------
 
 void AddrSpace::SaveState() {
+    if (kernel->tlbManager != NULL) {
+        kernel->tlbManager->Flush(this);
+    }
 }
 
 //----------------------------------------------------------------------
@@ -253,14 +269,65 @@ void AddrSpace::SaveState() {
 //  On a context switch, restore the machine state so that
 //  this address space can run.
 //
-//      For now, tell the machine where to find the page table.
+//      For now, tell the machine where to find the page table, and
+//      that the translations it was using are gone.  With a TLB, the
+//      machine never sees the page table: the TLB was emptied when
+//      the last address space stopped running, and is refilled from
+//      the page table as the program misses.
 //----------------------------------------------------------------------
 
 void AddrSpace::RestoreState() {
-    kernel->machine->pageTable = pageTable;
-    kernel->machine->pageTableSize = numPages;
+    if (kernel->tlbManager == NULL) {
+        kernel->machine->pageTable = pageTable;
+        kernel->machine->pageTableSize = numPages;
+    }
+
+    kernel->machine->InvalidateTranslations();
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::PageEntry
+//  Return the page table entry of virtual page "vpn", or NULL if the
+//  page is outside the address space.
+//----------------------------------------------------------------------
+
+TranslationEntry*
+AddrSpace::PageEntry(unsigned int vpn) {
+    if (vpn >= numPages) {
+        return NULL;
+    }
+
+    return &pageTable[vpn];
 }
 
+//----------------------------------------------------------------------
+// AddrSpace::InvalidateCode
+//  The kernel wrote "size" bytes of user memory at virtual address
+//  "virtAddr" (say, for a Read system call): throw away the decoded
+//  instructions of the physical pages underneath.  Pages outside the
+//  address space, or not mapped, hold nothing of ours and are skipped.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::InvalidateCode(int virtAddr, int size) {
+    if (virtAddr < 0 || size <= 0) {
+        return;
+    }
+
+    for (unsigned int vpn = virtAddr / PageSize;
+            vpn <= ((unsigned int) virtAddr + size - 1) / PageSize; vpn++) {
+        TranslationEntry* entry = PageEntry(vpn);
+
+        if (entry == NULL) {
+            break;              // the rest is outside the address space
+        }
+
+        if (entry->valid) {
+            kernel->machine->InvalidateCode(entry->physicalPage * PageSize,
+                                            PageSize);
+        }
+    }
+}
 
 //----------------------------------------------------------------------
 // AddrSpace::Translate
@@ -15,6 +15,7 @@
 
 #include "copyright.h"
 #include "filesys.h"
+#include "fdtable.h"
 
 #define UserStackSize       1024    // increase this as necessary!
 
@@ -39,6 +40,17 @@ public:
     // is 0 for Read, 1 for Write.
     ExceptionType Translate(unsigned int vaddr, unsigned int* paddr, int mode);
 
+    TranslationEntry* PageEntry(unsigned int vpn);
+    // The page table entry of virtual
+    // page "vpn", NULL if out of range
+
+    void InvalidateCode(int virtAddr, int size);
+    // Forget the decoded instructions of
+    // the pages "size" bytes at "virtAddr"
+    // touch, since they were written
+
+    FileDescriptorTable* openFiles;     // Files the program has open
+
 private:
     TranslationEntry* pageTable;    // Assume linear page table translation
     // for now!
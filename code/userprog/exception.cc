@@ -25,6 +25,7 @@
 #include "main.h"
 #include "syscall.h"
 #include "ksyscall.h"
+#include "tlbmanager.h"
 //----------------------------------------------------------------------
 // ExceptionHandler
 //  Entry point into the Nachos kernel.  Called when a user program
@@ -134,6 +135,11 @@ ExceptionHandler(ExceptionType which) {
                     int size = val5;
                     int id = val6;
                     status = SysRead(buffer, size, id);
+
+                    if (status > 0) {
+                        kernel->currentThread->space->InvalidateCode(val4, status);
+                    }
+
                     kernel->machine->WriteRegister(2, static_cast<int>(status));
                 }
 
@@ -194,6 +200,18 @@ ExceptionHandler(ExceptionType which) {
 
             break;
 
+        case PageFaultException:
+            // with a TLB, this is a TLB miss: load the translation and
+            // restart the instruction
+            if (kernel->tlbManager != NULL &&
+                    kernel->tlbManager->Refill(
+                        kernel->machine->ReadRegister(BadVAddrReg))) {
+                return;
+            }
+
+            cerr << "Unexpected user mode exception " << (int)which << "\n";
+            break;
+
         default:
             cerr << "Unexpected user mode exception " << (int)which << "\n";
             break;
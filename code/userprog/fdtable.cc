@@ -0,0 +1,149 @@
+// fdtable.cc
+//  Routines to manage the table of open files of a user program.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "debug.h"
+#include "fdtable.h"
+
+//----------------------------------------------------------------------
+// FileDescriptorTable::FileDescriptorTable
+//  Initialize a table with no files open, and every slot from
+//  FirstDescriptor on on the free list, in order.
+//----------------------------------------------------------------------
+
+FileDescriptorTable::FileDescriptorTable() {
+    size = InitialDescriptors;
+    files = new OpenFile*[size];
+    nextFree = new int[size];
+
+    for (int i = 0; i < size; i++) {
+        files[i] = NULL;
+        nextFree[i] = (i + 1 < size) ? i + 1 : -1;
+    }
+
+    firstFree = FirstDescriptor;
+}
+
+//----------------------------------------------------------------------
+// FileDescriptorTable::~FileDescriptorTable
+//  De-allocate the table.  The files the program left open must have
+//  been closed by CloseAll already: the table goes away with the
+//  thread, from inside the scheduler, where closing a file could not
+//  wait for the disk.
+//----------------------------------------------------------------------
+
+FileDescriptorTable::~FileDescriptorTable() {
+    for (int i = 0; i < size; i++) {
+        ASSERT(files[i] == NULL);
+    }
+
+    delete [] files;
+    delete [] nextFree;
+}
+
+//----------------------------------------------------------------------
+// FileDescriptorTable::Add
+//  Enter "file" in the first slot of the free list, growing the table
+//  if there is none, and return the slot number as its descriptor.
+//----------------------------------------------------------------------
+
+int
+FileDescriptorTable::Add(OpenFile* file) {
+    ASSERT(file != NULL);
+
+    if (firstFree == -1) {
+        Grow();
+    }
+
+    int fd = firstFree;
+    firstFree = nextFree[fd];
+    files[fd] = file;
+    DEBUG(dbgFile, "Descriptor " << fd << " opened");
+    return fd;
+}
+
+//----------------------------------------------------------------------
+// FileDescriptorTable::Get
+//  Return the file open as descriptor "fd", or NULL if "fd" is out of
+//  range or not open.
+//----------------------------------------------------------------------
+
+OpenFile*
+FileDescriptorTable::Get(int fd) {
+    if (fd < FirstDescriptor || fd >= size) {
+        return NULL;
+    }
+
+    return files[fd];
+}
+
+//----------------------------------------------------------------------
+// FileDescriptorTable::Remove
+//  Free descriptor "fd", putting its slot at the head of the free
+//  list, and return the file that was open there, for the caller to
+//  close.  Return NULL if "fd" was not open.
+//----------------------------------------------------------------------
+
+OpenFile*
+FileDescriptorTable::Remove(int fd) {
+    OpenFile* file = Get(fd);
+
+    if (file == NULL) {
+        return NULL;
+    }
+
+    files[fd] = NULL;
+    nextFree[fd] = firstFree;
+    firstFree = fd;
+    DEBUG(dbgFile, "Descriptor " << fd << " closed");
+    return file;
+}
+
+//----------------------------------------------------------------------
+// FileDescriptorTable::CloseAll
+//  Close every file the program still has open, freeing their
+//  descriptors.  Called when the program exits, by the thread itself.
+//----------------------------------------------------------------------
+
+void
+FileDescriptorTable::CloseAll() {
+    for (int fd = FirstDescriptor; fd < size; fd++) {
+        delete Remove(fd);
+    }
+}
+
+//----------------------------------------------------------------------
+// FileDescriptorTable::Grow
+//  Double the number of slots.  Only called when the free list is
+//  empty, so it becomes just the new slots, lowest first.
+//----------------------------------------------------------------------
+
+void
+FileDescriptorTable::Grow() {
+    int newSize = size * 2;
+    OpenFile** newFiles = new OpenFile*[newSize];
+    int* newNextFree = new int[newSize];
+
+    ASSERT(firstFree == -1);
+
+    for (int i = 0; i < newSize; i++) {
+        if (i < size) {
+            newFiles[i] = files[i];
+            newNextFree[i] = nextFree[i];
+        } else {
+            newFiles[i] = NULL;
+            newNextFree[i] = (i + 1 < newSize) ? i + 1 : -1;
+        }
+    }
+
+    delete [] files;
+    delete [] nextFree;
+    files = newFiles;
+    nextFree = newNextFree;
+    firstFree = size;
+    size = newSize;
+}
@@ -0,0 +1,58 @@
+// fdtable.h
+//  Data structures for the table of open files of a user program.
+//
+//  Each address space has its own table, mapping the small integers
+//  a user program passes to Read, Write and Close (its "file
+//  descriptors", OpenFileId in syscall.h) to the files it opened.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef FDTABLE_H
+#define FDTABLE_H
+
+#include "copyright.h"
+#include "openfile.h"
+
+// Descriptors below this one are never handed out, so that a user
+// program can tell a failed Open (-1) or an unset id (0) from a file.
+const int FirstDescriptor = 1;
+
+// Slots a table starts with; it doubles whenever it runs out.
+const int InitialDescriptors = 16;
+
+// The following class defines a file descriptor table.
+//
+// The slots that are not in use are chained into a free list through
+// "nextFree", so that opening a file takes the head of the list and
+// closing one pushes its slot back, both in constant time however
+// many files are open.  When the list is empty, the table doubles
+// in size and the new slots go on the list, lowest first.
+
+class FileDescriptorTable {
+public:
+    FileDescriptorTable();      // Initialize an empty table
+    ~FileDescriptorTable();     // De-allocate the table; CloseAll
+    // must have closed its files
+
+    int Add(OpenFile* file);    // Give "file" a descriptor, and
+    // return it
+    OpenFile* Get(int fd);      // The file open as "fd", or NULL
+    // if there is none
+    OpenFile* Remove(int fd);   // Free descriptor "fd", and return
+    // the file it was (NULL if none);
+    // the caller closes the file
+    void CloseAll();            // Close every file still open
+
+private:
+    int size;                   // Number of slots
+    OpenFile** files;           // File open in each slot, or NULL
+    int* nextFree;              // For a free slot, the next free one
+    // on the list, -1 at the end
+    int firstFree;              // Head of the free list, -1 if empty
+
+    void Grow();                // Double the number of slots
+};
+
+#endif // FDTABLE_H
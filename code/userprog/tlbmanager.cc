@@ -0,0 +1,158 @@
+// tlbmanager.cc
+//  Routines to handle TLB misses, loading translations from the
+//  page table of the running program.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "main.h"
+#include "addrspace.h"
+#include "tlbmanager.h"
+
+// Names of the replacement policies, for the statistics.
+static const char* policyNames[] = { "FIFO", "random", "LRU" };
+
+//----------------------------------------------------------------------
+// TLBManager::TLBManager
+//  Initialize TLB miss handling for the machine's TLB, which starts
+//  out empty.
+//
+//  "policyName" -- the replacement policy: "fifo", "random" or "lru",
+//      or NULL for the default, LRU
+//----------------------------------------------------------------------
+
+TLBManager::TLBManager(char* policyName) {
+    ASSERT(kernel->machine->tlb != NULL);
+
+    policy = TLBLRU;
+    if (policyName != NULL) {
+        if (strcmp(policyName, "fifo") == 0) {
+            policy = TLBFIFO;
+        } else if (strcmp(policyName, "random") == 0) {
+            policy = TLBRandom;
+        } else {
+            ASSERT(strcmp(policyName, "lru") == 0);
+        }
+    }
+    kernel->stats->tlbPolicy = policyNames[policy];
+    kernel->stats->tlbEntries = kernel->machine->tlbSize;
+
+    nextVictim = 0;
+}
+
+//----------------------------------------------------------------------
+// TLBManager::Refill
+//  Handle a TLB miss at "virtAddr" in the running program: copy the
+//  page table entry of its page into the TLB, so the instruction that
+//  missed can be restarted.  Return FALSE if the page is not in the
+//  address space, which is a real addressing error.
+//----------------------------------------------------------------------
+
+bool
+TLBManager::Refill(int virtAddr) {
+    AddrSpace* space = kernel->currentThread->space;
+    TranslationEntry* tlb = kernel->machine->tlb;
+    TranslationEntry* pte = space->PageEntry((unsigned) virtAddr / PageSize);
+
+    if (pte == NULL || !pte->valid) {
+        return FALSE;
+    }
+
+    int victim = Victim();
+
+    if (tlb[victim].valid) {
+        WriteBack(space, &tlb[victim]);
+    }
+
+    DEBUG(dbgAddr, "TLB entry " << victim << " loaded with virtual page "
+          << pte->virtualPage);
+    tlb[victim] = *pte;
+    kernel->machine->InvalidateTranslations();
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// TLBManager::Flush
+//  Empty the TLB when "space", whose entries it holds, stops running,
+//  writing back the use and dirty bits first.
+//----------------------------------------------------------------------
+
+void
+TLBManager::Flush(AddrSpace* space) {
+    Machine* machine = kernel->machine;
+
+    for (int i = 0; i < machine->tlbSize; i++) {
+        if (machine->tlb[i].valid) {
+            WriteBack(space, &machine->tlb[i]);
+            machine->tlb[i].valid = FALSE;
+        }
+    }
+
+    nextVictim = 0;
+    machine->InvalidateTranslations();
+}
+
+//----------------------------------------------------------------------
+// TLBManager::Victim
+//  Return the TLB entry a refill should use: a free one if there is
+//  one, otherwise the one the policy picks.
+//
+//  Free entries are only left after a flush, and are taken in order,
+//  so for FIFO the entry loaded longest ago is then entry 0.
+//----------------------------------------------------------------------
+
+int
+TLBManager::Victim() {
+    Machine* machine = kernel->machine;
+    int victim;
+
+    for (int i = 0; i < machine->tlbSize; i++) {
+        if (!machine->tlb[i].valid) {
+            return i;
+        }
+    }
+
+    switch (policy) {
+        case TLBFIFO:
+            victim = nextVictim;
+            nextVictim = (nextVictim + 1) % machine->tlbSize;
+            break;
+
+        case TLBRandom:
+            victim = RandomNumber() % machine->tlbSize;
+            break;
+
+        case TLBLRU:
+            victim = 0;
+            for (int i = 1; i < machine->tlbSize; i++) {
+                if (machine->tlbLastUse[i] < machine->tlbLastUse[victim]) {
+                    victim = i;
+                }
+            }
+            break;
+
+        default:
+            ASSERTNOTREACHED();
+    }
+
+    return victim;
+}
+
+//----------------------------------------------------------------------
+// TLBManager::WriteBack
+//  The machine may have set the use and dirty bits of TLB entry
+//  "entry", a copy of one of the page table entries of "space"; copy
+//  them back to the page table before the entry is dropped.
+//----------------------------------------------------------------------
+
+void
+TLBManager::WriteBack(AddrSpace* space, TranslationEntry* entry) {
+    TranslationEntry* pte = space->PageEntry(entry->virtualPage);
+
+    if (pte != NULL) {
+        pte->use = entry->use;
+        pte->dirty = entry->dirty;
+    }
+}
@@ -0,0 +1,56 @@
+// tlbmanager.h
+//  Data structures for managing the software-loaded TLB.
+//
+//  When Nachos runs with a TLB (-tlb), the machine translates only
+//  through it, and a reference to a page it has no entry for raises
+//  PageFaultException.  The kernel then loads the page's entry from
+//  the address space's page table into the TLB, replacing an entry
+//  chosen by the replacement policy, and restarts the instruction.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef TLBMANAGER_H
+#define TLBMANAGER_H
+
+#include "copyright.h"
+#include "translate.h"
+
+class AddrSpace;
+
+// Which TLB entry a refill replaces, when all of them are in use.
+enum TLBPolicy { TLBFIFO,       // the one loaded longest ago
+                 TLBRandom,     // any, at random
+                 TLBLRU         // the one used longest ago
+               };
+
+// The following class defines the kernel's TLB miss handling.
+//
+// The TLB holds copies of page table entries, and the machine sets
+// the use and dirty bits in the copies; they are written back to the
+// page table when an entry is replaced, and when the TLB is flushed on
+// a context switch away from the address space.
+
+class TLBManager {
+public:
+    TLBManager(char* policyName);       // "fifo", "random" or "lru";
+    // NULL for the default (LRU)
+
+    bool Refill(int virtAddr);  // Load the translation of "virtAddr"
+    // for the running program; FALSE if
+    // it is not in its address space
+    void Flush(AddrSpace* space);       // Write back and empty the TLB,
+    // which holds entries of "space"
+
+private:
+    TLBPolicy policy;
+    int nextVictim;             // For FIFO, the entry loaded longest ago
+
+    int Victim();               // Choose the entry to replace
+    void WriteBack(AddrSpace* space, TranslationEntry* entry);
+    // Copy the use and dirty bits of a TLB
+    // entry to the page table
+};
+
+#endif // TLBMANAGER_H